@@ -0,0 +1,125 @@
+// Sweeps bucket associativity: for 2, 4 and 8 tags per bucket and 8, 12 and
+// 16 bit tags, fills a filter until an insert fails and reports, at a few
+// load factors on the way and at the last one reached, the false positive
+// rate and the lookup time of keys that are in the filter and keys that
+// are not.
+//
+// Usage: associativity [slot_count]
+//   slot_count accepts K/M/B suffixes and defaults to 16M; every filter
+//   has that many tag slots.
+
+#include "cuckoofilter.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::Associativity;
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+const size_t kNumQueries = 2 * 1000 * 1000;
+
+const double kLoadFactors[] = {0.5, 0.75, 0.9, 0.95};
+
+// Print the false positive rate and lookup times of filter, holding keys
+// [0, added)
+template <typename Filter>
+void Measure(const Filter &filter, size_t ways, size_t bits, size_t added,
+             size_t num_slots) {
+  std::vector<uint64_t> hits(kNumQueries), misses(kNumQueries);
+  for (size_t q = 0; q < kNumQueries; q++) {
+    hits[q] = Key(Key(~q) % added);
+    misses[q] = Key(num_slots + q);
+  }
+
+  size_t found = 0;
+  uint64_t start = NowNanos();
+  for (uint64_t key : hits) {
+    found += (filter.Contain(key) == cuckoofilter::Ok);
+  }
+  uint64_t hit_ns = NowNanos() - start;
+
+  size_t false_positives = 0;
+  start = NowNanos();
+  for (uint64_t key : misses) {
+    false_positives += (filter.Contain(key) == cuckoofilter::Ok);
+  }
+  uint64_t miss_ns = NowNanos() - start;
+
+  if (found != kNumQueries) {
+    std::cout << "False negatives seen\n";
+  }
+  std::cout << std::setw(6) << ways << std::setw(6) << bits << std::fixed
+            << std::setprecision(4) << std::setw(10) << filter.LoadFactor()
+            << std::setw(10) << 100.0 * false_positives / kNumQueries
+            << std::setprecision(2) << std::setw(10)
+            << 8.0 * filter.SizeInBytes() / added << std::setw(10)
+            << 1.0 * hit_ns / kNumQueries << std::setw(10)
+            << 1.0 * miss_ns / kNumQueries << "\n";
+}
+
+template <size_t ways, size_t bits>
+void Run(size_t num_slots) {
+  typedef CuckooFilter<uint64_t, bits, Associativity<ways>::template SingleTable>
+      Filter;
+  // Just over half the slots in keys, which rounds the table up to
+  // num_slots slots whatever the associativity
+  Filter filter(num_slots / 2 + 1);
+  if (!filter.Valid()) {
+    std::cout << "Failed to allocate a filter of " << num_slots << " slots\n";
+    return;
+  }
+
+  size_t added = 0;
+  for (double load : kLoadFactors) {
+    const size_t target = load * num_slots;
+    for (; added < target; added++) {
+      if (filter.Add(Key(added)) != cuckoofilter::Ok) {
+        break;
+      }
+    }
+    if (added < target) {
+      break;
+    }
+    Measure(filter, ways, bits, added, num_slots);
+  }
+  // Up to the first insert that fails
+  while (filter.Add(Key(added)) == cuckoofilter::Ok) {
+    added++;
+  }
+  Measure(filter, ways, bits, added, num_slots);
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t num_slots = 16 * 1000 * 1000;
+  if (argc > 1) {
+    num_slots = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  num_slots = cuckoofilter::upperpower2(num_slots);
+
+  std::cout << num_slots << " slots\n"
+            << std::setw(6) << "ways" << std::setw(6) << "bits"
+            << std::setw(10) << "load" << std::setw(10) << "fpp %"
+            << std::setw(10) << "bits/key" << std::setw(10) << "hit ns"
+            << std::setw(10) << "miss ns\n";
+  Run<2, 8>(num_slots);
+  Run<4, 8>(num_slots);
+  Run<8, 8>(num_slots);
+  Run<2, 12>(num_slots);
+  Run<4, 12>(num_slots);
+  Run<8, 12>(num_slots);
+  Run<2, 16>(num_slots);
+  Run<4, 16>(num_slots);
+  Run<8, 16>(num_slots);
+  return 0;
+}
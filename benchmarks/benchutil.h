@@ -0,0 +1,58 @@
+#ifndef CUCKOO_FILTER_BENCHUTIL_H_
+#define CUCKOO_FILTER_BENCHUTIL_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace cuckoofilter {
+namespace bench {
+
+// Nanoseconds from an arbitrary, monotonic starting point
+inline uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// SplitMix64: maps i to a well mixed key, so key i can be regenerated from
+// its index instead of being kept in memory for billion-item runs.
+inline uint64_t Key(uint64_t i) {
+  uint64_t z = i + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Parse "1M", "100M", "1B" style sizes from the command line
+inline size_t ParseCount(const std::string &s) {
+  char *end = nullptr;
+  double v = strtod(s.c_str(), &end);
+  switch (*end) {
+    case 'k': case 'K': v *= 1e3; break;
+    case 'm': case 'M': v *= 1e6; break;
+    case 'b': case 'B': case 'g': case 'G': v *= 1e9; break;
+  }
+  return static_cast<size_t>(v);
+}
+
+// Item counts named on the command line, or the defaults if there are none
+inline std::vector<size_t> ParseCounts(int argc, const char **argv,
+                                       std::vector<size_t> defaults) {
+  if (argc < 2) {
+    return defaults;
+  }
+  std::vector<size_t> counts;
+  for (int i = 1; i < argc; i++) {
+    counts.push_back(ParseCount(argv[i]));
+  }
+  return counts;
+}
+
+}  // namespace bench
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_BENCHUTIL_H_
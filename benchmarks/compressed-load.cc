@@ -0,0 +1,102 @@
+// Measures the size of compressed snapshots against Save's, and how long
+// they take to load on 1 and on load_threads threads, for tables filled to
+// several load factors. Both files are read from the page cache, so the
+// loads show decoding against copying rather than the disk.
+//
+// Usage: compressed-load [item_count] [load_threads] [path]
+//   item_count accepts K/M/B suffixes and defaults to 100M, the number of
+//   items of the fullest table; load_threads defaults to the number of
+//   hardware threads. The filters are saved to path and path.z,
+//   /tmp/compressed-load.filter by default, and removed at the end.
+
+#include "cuckoofilter.h"
+
+#include <stdio.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+typedef CuckooFilter<uint64_t, 12> Filter;
+
+const double kLoadFactors[] = {0.25, 0.5, 0.75, 0.95};
+
+size_t FileSize(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+// Milliseconds to load path on num_threads threads, or -1 if it fails
+double LoadMillis(const std::string &path, size_t num_threads) {
+  uint64_t start = NowNanos();
+  Filter filter(path, true, num_threads);
+  uint64_t ns = NowNanos() - start;
+  return filter.Valid() ? ns / 1e6 : -1;
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 100 * 1000 * 1000;
+  size_t load_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::string path = "/tmp/compressed-load.filter";
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    load_threads = std::stoul(argv[2]);
+  }
+  if (argc > 3) {
+    path = argv[3];
+  }
+  const std::string compressed_path = path + ".z";
+
+  std::cout << std::setw(6) << "load" << std::setw(14) << "raw MB"
+            << std::setw(10) << "ratio" << std::setw(12) << "raw ms"
+            << std::setw(12) << "1 thread" << std::setw(12)
+            << (std::to_string(load_threads) + " threads") << "\n";
+  for (double load : kLoadFactors) {
+    {
+      Filter filter(total_items);
+      const size_t num_items = load * filter.SizeInBytes() * 8 / 12;
+      for (size_t i = 0; i < num_items; i++) {
+        filter.Add(Key(i));
+      }
+      if (!filter.Save(path) ||
+          !filter.SaveCompressed(compressed_path, load_threads)) {
+        std::cout << "Failed to save " << path << "\n";
+        return 1;
+      }
+    }
+    // Warm the page cache
+    LoadMillis(path, 1);
+    LoadMillis(compressed_path, 1);
+
+    const size_t raw_size = FileSize(path);
+    std::cout << std::setw(6) << std::fixed << std::setprecision(2) << load
+              << std::setw(14) << std::setprecision(1) << raw_size / 1e6
+              << std::setw(10) << std::setprecision(3)
+              << 1.0 * FileSize(compressed_path) / raw_size << std::setw(12)
+              << std::setprecision(1) << LoadMillis(path, 1) << std::setw(12)
+              << LoadMillis(compressed_path, 1) << std::setw(12)
+              << LoadMillis(compressed_path, load_threads) << "\n";
+  }
+  remove(path.c_str());
+  remove(compressed_path.c_str());
+  return 0;
+}
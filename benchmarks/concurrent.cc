@@ -0,0 +1,147 @@
+// Measures lookup and update throughput of ConcurrentCuckooFilter against a
+// CuckooFilter behind a mutex, for a sweep of reader and writer threads.
+// Readers only look up keys that are never deleted, so any miss they report
+// is a false negative and is counted.
+//
+// Usage: concurrent [item_count] [seconds] [max_readers]
+//   item_count accepts K/M/B suffixes and defaults to 10M; each point of the
+//   sweep runs for seconds (default 1); readers go up to max_readers,
+//   by default the number of hardware threads.
+
+#include "concurrentcuckoofilter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::ConcurrentCuckooFilter;
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+// The baseline: every operation takes one global lock
+class MutexFilter {
+  CuckooFilter<uint64_t, 12> filter_;
+  std::mutex mutex_;
+
+ public:
+  explicit MutexFilter(size_t max_num_keys) : filter_(max_num_keys) {}
+
+  cuckoofilter::Status Add(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Add(key);
+  }
+
+  cuckoofilter::Status Contain(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Contain(key);
+  }
+
+  cuckoofilter::Status Delete(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Delete(key);
+  }
+};
+
+struct Result {
+  double read_mops;
+  double write_mops;
+  size_t false_negatives;
+};
+
+template <typename FilterType>
+Result Run(size_t total_items, double seconds, size_t readers,
+           size_t writers) {
+  FilterType filter(total_items);
+  // Half the capacity is stable keys the readers look up...
+  const size_t stable = total_items / 2;
+  for (size_t i = 0; i < stable; i++) {
+    filter.Add(Key(i));
+  }
+  // ...and each writer cycles keys of its own through a window of the rest
+  const size_t window = std::max<size_t>(1, total_items / 4 / std::max<size_t>(1, writers));
+
+  std::atomic<bool> stop(false);
+  std::atomic<size_t> reads(0), updates(0), false_negatives(0);
+  std::vector<std::thread> threads;
+  for (size_t r = 0; r < readers; r++) {
+    threads.emplace_back([&, r]() {
+      size_t n = 0, misses = 0;
+      for (uint64_t q = Key(r); !stop.load(std::memory_order_relaxed); n++) {
+        q = Key(q);
+        misses += (filter.Contain(Key(q % stable)) != cuckoofilter::Ok);
+      }
+      reads += n;
+      false_negatives += misses;
+    });
+  }
+  for (size_t w = 0; w < writers; w++) {
+    threads.emplace_back([&, w]() {
+      size_t n = 0;
+      for (size_t t = 0; !stop.load(std::memory_order_relaxed); t++) {
+        const uint64_t base = total_items + w;
+        filter.Add(Key(base + writers * t));
+        if (t >= window) {
+          filter.Delete(Key(base + writers * (t - window)));
+        }
+        n += 2;
+      }
+      updates += n;
+    });
+  }
+
+  uint64_t start = NowNanos();
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(static_cast<int>(seconds * 1000)));
+  stop = true;
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double elapsed_us = (NowNanos() - start) / 1e3;
+  return Result{reads / elapsed_us, updates / elapsed_us, false_negatives};
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 10 * 1000 * 1000;
+  double seconds = 1;
+  size_t max_readers = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    seconds = std::stod(argv[2]);
+  }
+  if (argc > 3) {
+    max_readers = std::stoul(argv[3]);
+  }
+
+  std::cout << std::setw(8) << "readers" << std::setw(8) << "writers"
+            << std::setw(14) << "mutex read" << std::setw(14) << "mutex write"
+            << std::setw(14) << "conc read" << std::setw(14) << "conc write"
+            << std::setw(8) << "fneg" << "   (Mops/s)\n";
+  for (size_t writers : {0, 1, 2}) {
+    for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+      Result m = Run<MutexFilter>(total_items, seconds, readers, writers);
+      Result c = Run<ConcurrentCuckooFilter<uint64_t, 12>>(
+          total_items, seconds, readers, writers);
+      std::cout << std::setw(8) << readers << std::setw(8) << writers
+                << std::fixed << std::setprecision(2) << std::setw(14)
+                << m.read_mops << std::setw(14) << m.write_mops
+                << std::setw(14) << c.read_mops << std::setw(14)
+                << c.write_mops << std::setw(8)
+                << m.false_negatives + c.false_negatives << "\n";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Compares per-key Contain with ContainBatch on filters of growing size.
+//
+// Usage: contain-batch [item_count ...]
+//   item_count accepts K/M/B suffixes and defaults to 1M 100M 1B. Filters
+//   larger than the last level cache are where batching pays off.
+
+#include "cuckoofilter.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+const size_t kMaxQueries = 10 * 1000 * 1000;
+const size_t kBatch = 1024;
+
+void Run(size_t total_items) {
+  CuckooFilter<uint64_t, 12> filter(total_items);
+  if (!filter.Valid()) {
+    std::cout << "Failed to allocate a filter for " << total_items
+              << " items\n";
+    return;
+  }
+  for (size_t i = 0; i < total_items; i++) {
+    if (filter.Add(Key(i)) != cuckoofilter::Ok) {
+      std::cout << "Filter full after " << i << " items\n";
+      break;
+    }
+  }
+
+  // Half of the queries hit inserted keys, half miss
+  size_t num_queries = std::min(kMaxQueries, 2 * total_items);
+  std::vector<uint64_t> queries(num_queries);
+  for (size_t q = 0; q < num_queries; q++) {
+    size_t r = Key(~q) % total_items;
+    queries[q] = (q & 1) ? Key(r) : Key(total_items + r);
+  }
+
+  size_t found = 0;
+  uint64_t start = NowNanos();
+  for (size_t q = 0; q < num_queries; q++) {
+    found += (filter.Contain(queries[q]) == cuckoofilter::Ok);
+  }
+  uint64_t single_ns = NowNanos() - start;
+
+  std::vector<uint8_t> results(kBatch);
+  size_t batch_found = 0;
+  start = NowNanos();
+  for (size_t q = 0; q < num_queries; q += kBatch) {
+    size_t n = std::min(kBatch, num_queries - q);
+    filter.ContainBatch(&queries[q], n, results.data());
+    for (size_t k = 0; k < n; k++) {
+      batch_found += (results[k] == cuckoofilter::Ok);
+    }
+  }
+  uint64_t batch_ns = NowNanos() - start;
+
+  if (found != batch_found) {
+    std::cout << "Mismatch: Contain found " << found << ", ContainBatch found "
+              << batch_found << "\n";
+  }
+  std::cout << std::setw(12) << total_items << std::setw(12)
+            << filter.SizeInBytes() / (1 << 20) << std::fixed
+            << std::setprecision(2) << std::setw(14)
+            << 1.0 * single_ns / num_queries << std::setw(14)
+            << 1.0 * batch_ns / num_queries << std::setw(10)
+            << 1.0 * single_ns / batch_ns << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  std::vector<size_t> counts = cuckoofilter::bench::ParseCounts(
+      argc, argv, {1000000, 100000000, 1000000000});
+  std::cout << std::setw(12) << "items" << std::setw(12) << "MiB"
+            << std::setw(14) << "Contain ns" << std::setw(14) << "Batch ns"
+            << std::setw(10) << "speedup" << "\n";
+  for (size_t n : counts) {
+    Run(n);
+  }
+  return 0;
+}
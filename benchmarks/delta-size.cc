@@ -0,0 +1,108 @@
+// Measures delta snapshots: how large the delta between a filter and the
+// same filter after some updates is, next to the whole file, and how long
+// SaveDelta and ApplyDelta take. Each round adds update_count keys and
+// deletes update_count / 2 of the original ones.
+//
+// Usage: delta-size [item_count] [path]
+//   item_count accepts K/M/B suffixes and defaults to 100M; the filter and
+//   the deltas are saved to path and path.delta, /tmp/delta-size.filter by
+//   default, and removed at the end.
+
+#include "cuckoofilter.h"
+
+#include <stdio.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+typedef CuckooFilter<uint64_t, 12> Filter;
+
+const size_t kUpdateCounts[] = {1000, 10000, 100000, 1000000};
+
+size_t FileSize(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 100 * 1000 * 1000;
+  std::string path = "/tmp/delta-size.filter";
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    path = argv[2];
+  }
+  const std::string delta_path = path + ".delta";
+
+  // Leave room for the updates
+  const size_t num_items = total_items * 9 / 10;
+  {
+    Filter filter(total_items);
+    for (size_t i = 0; i < num_items; i++) {
+      filter.Add(Key(i));
+    }
+    if (!filter.Save(path)) {
+      std::cout << "Failed to save " << path << "\n";
+      return 1;
+    }
+  }
+  const size_t file_size = FileSize(path);
+  std::cout << num_items << " items, " << file_size << " bytes saved\n"
+            << std::setw(10) << "updates" << std::setw(14) << "delta bytes"
+            << std::setw(10) << "ratio" << std::setw(12) << "save ms"
+            << std::setw(12) << "apply ms\n";
+
+  for (size_t updates : kUpdateCounts) {
+    Filter base(path);
+    Filter next(path);
+    for (size_t i = 0; i < updates; i++) {
+      next.Add(Key(num_items + i));
+    }
+    for (size_t i = 0; i < updates / 2; i++) {
+      next.Delete(Key(i));
+    }
+
+    uint64_t start = NowNanos();
+    if (!next.SaveDelta(base, delta_path)) {
+      std::cout << "Failed to save " << delta_path << "\n";
+      return 1;
+    }
+    uint64_t save_ns = NowNanos() - start;
+
+    start = NowNanos();
+    cuckoofilter::Status status = base.ApplyDelta(delta_path);
+    uint64_t apply_ns = NowNanos() - start;
+    if (status != cuckoofilter::Ok || base.Size() != next.Size()) {
+      std::cout << "Failed to apply " << delta_path << "\n";
+      return 1;
+    }
+
+    const size_t delta_size = FileSize(delta_path);
+    std::cout << std::setw(10) << updates << std::setw(14) << delta_size
+              << std::setw(10) << std::fixed << std::setprecision(4)
+              << 1.0 * delta_size / file_size << std::setw(12)
+              << std::setprecision(1) << save_ns / 1e6 << std::setw(11)
+              << apply_ns / 1e6 << "\n";
+  }
+  remove(path.c_str());
+  remove(delta_path.c_str());
+  return 0;
+}
@@ -0,0 +1,228 @@
+// Measures what choosing bits_per_item at runtime costs per key: a
+// CuckooFilter<uint64_t, bits> called directly, the same filter called
+// through BaseCuckooFilter, and a DynamicCuckooFilter called per key, per
+// batch and through Visit.
+//
+// Usage: dispatch [bits_per_item] [item_count ...]
+//   bits_per_item is 2, 4, 8, 12, 16 or 32 and defaults to 12; item_count
+//   accepts K/M/B suffixes and defaults to 1M 100M. Small filters show the call overhead best, as
+//   there the lookups hit the cache. Each number is the best of 3 runs.
+
+#include "dynamiccuckoofilter.h"
+
+#include <stdlib.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::BaseCuckooFilter;
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::DynamicCuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+const size_t kMaxQueries = 10 * 1000 * 1000;
+const size_t kBatch = 1024;
+
+// every measurement is the best of this many runs, each on a new filter
+const size_t kRuns = 3;
+
+struct Timing {
+  double add_ns;
+  double contain_ns;
+};
+
+Timing Best(const Timing &a, const Timing &b) {
+  return Timing{std::min(a.add_ns, b.add_ns),
+                std::min(a.contain_ns, b.contain_ns)};
+}
+
+void Print(const std::string &name, const Timing &t) {
+  std::cout << std::setw(16) << name << std::setw(10) << std::fixed
+            << std::setprecision(1) << t.add_ns << std::setw(12)
+            << t.contain_ns << "\n";
+}
+
+// The keys are generated up front, so that only the filter calls are timed
+struct Keys {
+  std::vector<uint64_t> adds, queries;
+  Keys(size_t total_items) : adds(total_items) {
+    for (size_t i = 0; i < total_items; i++) {
+      adds[i] = Key(i);
+    }
+    size_t num_queries = std::min(kMaxQueries, 2 * total_items);
+    queries.resize(num_queries);
+    for (size_t q = 0; q < num_queries; q++) {
+      queries[q] = Key(Key(~q) % (2 * total_items));
+    }
+  }
+};
+
+// Per key calls on a filter of static type FilterType. With a
+// BaseCuckooFilter they are virtual.
+template <typename FilterType>
+Timing PerKey(FilterType *filter, const Keys &keys) {
+  uint64_t start = NowNanos();
+  for (uint64_t key : keys.adds) {
+    filter->Add(key);
+  }
+  uint64_t add_ns = NowNanos() - start;
+
+  size_t found = 0;
+  start = NowNanos();
+  for (uint64_t key : keys.queries) {
+    found += (filter->Contain(key) == cuckoofilter::Ok);
+  }
+  uint64_t contain_ns = NowNanos() - start;
+  if (found == 0) {
+    std::cout << "no key found\n";
+  }
+  return Timing{1.0 * add_ns / keys.adds.size(),
+                1.0 * contain_ns / keys.queries.size()};
+}
+
+Timing Batched(DynamicCuckooFilter<uint64_t> *filter, const Keys &keys) {
+  uint8_t results[kBatch];
+  uint64_t start = NowNanos();
+  for (size_t i = 0; i < keys.adds.size(); i += kBatch) {
+    filter->AddBatch(&keys.adds[i], std::min(kBatch, keys.adds.size() - i),
+                     results);
+  }
+  uint64_t add_ns = NowNanos() - start;
+
+  size_t found = 0;
+  start = NowNanos();
+  for (size_t i = 0; i < keys.queries.size(); i += kBatch) {
+    size_t n = std::min(kBatch, keys.queries.size() - i);
+    filter->ContainBatch(&keys.queries[i], n, results);
+    for (size_t k = 0; k < n; k++) {
+      found += (results[k] == cuckoofilter::Ok);
+    }
+  }
+  uint64_t contain_ns = NowNanos() - start;
+  if (found == 0) {
+    std::cout << "no key found\n";
+  }
+  return Timing{1.0 * add_ns / keys.adds.size(),
+                1.0 * contain_ns / keys.queries.size()};
+}
+
+// The PerKey loops compiled for the filter's width
+struct PerKeyVisitor {
+  const Keys &keys;
+  template <typename F>
+  Timing operator()(F &filter) const {
+    uint64_t start = NowNanos();
+    for (uint64_t key : keys.adds) {
+      filter.F::Add(key);
+    }
+    uint64_t add_ns = NowNanos() - start;
+
+    size_t found = 0;
+    start = NowNanos();
+    for (uint64_t key : keys.queries) {
+      found += (filter.F::Contain(key) == cuckoofilter::Ok);
+    }
+    uint64_t contain_ns = NowNanos() - start;
+    if (found == 0) {
+      std::cout << "no key found\n";
+    }
+    return Timing{1.0 * add_ns / keys.adds.size(),
+                  1.0 * contain_ns / keys.queries.size()};
+  }
+};
+
+template <size_t bits>
+Timing RunDirect(const Keys &keys, size_t total_items) {
+  CuckooFilter<uint64_t, bits> filter(total_items);
+  // Called through a pointer to the most derived type, the calls are
+  // direct
+  return PerKey(&filter, keys);
+}
+
+// The widths RunDirect and NewFilter are instantiated for
+bool Benchmarked(size_t bits) {
+  switch (bits) {
+    case 2: case 4: case 8: case 12: case 16: case 32: return true;
+    default: return false;
+  }
+}
+
+BaseCuckooFilter<uint64_t> *NewFilter(size_t bits, size_t total_items) {
+  switch (bits) {
+    case 2: return new CuckooFilter<uint64_t, 2>(total_items);
+    case 4: return new CuckooFilter<uint64_t, 4>(total_items);
+    case 8: return new CuckooFilter<uint64_t, 8>(total_items);
+    case 16: return new CuckooFilter<uint64_t, 16>(total_items);
+    case 32: return new CuckooFilter<uint64_t, 32>(total_items);
+    default: return new CuckooFilter<uint64_t, 12>(total_items);
+  }
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t bits = 12;
+  if (argc > 1) {
+    bits = atoi(argv[1]);
+  }
+  if (!Benchmarked(bits)) {
+    std::cout << "Unsupported bits_per_item " << bits
+              << ", use 2, 4, 8, 12, 16 or 32\n";
+    return 1;
+  }
+  std::vector<size_t> counts = cuckoofilter::bench::ParseCounts(
+      argc - 1, argv + 1, {1000 * 1000, 100 * 1000 * 1000});
+
+  for (size_t total_items : counts) {
+    Keys keys(total_items);
+    std::cout << total_items << " items, " << bits << " bits per item\n"
+              << std::setw(16) << "call" << std::setw(10) << "add ns"
+              << std::setw(12) << "contain ns\n";
+    Timing direct, virt, dynamic, batch, visit;
+    for (size_t run = 0; run < kRuns; run++) {
+      Timing t;
+      switch (bits) {
+        case 2: t = RunDirect<2>(keys, total_items); break;
+        case 4: t = RunDirect<4>(keys, total_items); break;
+        case 8: t = RunDirect<8>(keys, total_items); break;
+        case 16: t = RunDirect<16>(keys, total_items); break;
+        case 32: t = RunDirect<32>(keys, total_items); break;
+        default: t = RunDirect<12>(keys, total_items); break;
+      }
+      direct = run == 0 ? t : Best(direct, t);
+
+      std::unique_ptr<BaseCuckooFilter<uint64_t>> base(
+          NewFilter(bits, total_items));
+      t = PerKey(base.get(), keys);
+      virt = run == 0 ? t : Best(virt, t);
+      base.reset();
+
+      std::unique_ptr<DynamicCuckooFilter<uint64_t>> filter(
+          new DynamicCuckooFilter<uint64_t>(bits, total_items));
+      t = PerKey(filter.get(), keys);
+      dynamic = run == 0 ? t : Best(dynamic, t);
+
+      filter.reset(new DynamicCuckooFilter<uint64_t>(bits, total_items));
+      t = Batched(filter.get(), keys);
+      batch = run == 0 ? t : Best(batch, t);
+
+      filter.reset(new DynamicCuckooFilter<uint64_t>(bits, total_items));
+      t = filter->Visit<Timing>(PerKeyVisitor{keys});
+      visit = run == 0 ? t : Best(visit, t);
+    }
+    Print("direct", direct);
+    Print("virtual", virt);
+    Print("dynamic", dynamic);
+    Print("dynamic batch", batch);
+    Print("dynamic visit", visit);
+    std::cout << "\n";
+  }
+  return 0;
+}
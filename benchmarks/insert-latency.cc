@@ -0,0 +1,143 @@
+// Compares the insert latency of the random walk and breadth-first insert
+// strategies as a filter fills up. For each range of load factors it reports
+// latency percentiles, tag writes per insert and a histogram of latencies.
+//
+// Usage: insert-latency [item_count ...]
+//   item_count accepts K/M/B suffixes and defaults to 1M 100M. Each filter
+//   is sized for item_count items and filled until an insert fails.
+
+#include "cuckoofilter.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::SingleTable;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+// Tag writes done by all CountingTables
+size_t tag_writes = 0;
+
+// A SingleTable that counts the tags it writes
+template <size_t bits_per_tag>
+class CountingTable : public SingleTable<bits_per_tag> {
+ public:
+  using SingleTable<bits_per_tag>::SingleTable;
+
+  void WriteTag(const size_t i, const size_t j, const uint32_t t) {
+    tag_writes++;
+    SingleTable<bits_per_tag>::WriteTag(i, j, t);
+  }
+
+  bool InsertTagToBucket(const size_t i, const uint32_t tag,
+                         const bool kickout, uint32_t &oldtag) {
+    bool ok = SingleTable<bits_per_tag>::InsertTagToBucket(i, tag, kickout,
+                                                           oldtag);
+    tag_writes += ok || kickout;
+    return ok;
+  }
+};
+
+class Filter : public CuckooFilter<uint64_t, 12, CountingTable> {
+ public:
+  using CuckooFilter<uint64_t, 12, CountingTable>::CuckooFilter;
+  double Load() const { return LoadFactor(); }
+};
+
+// upper ends of the load factor ranges reported
+const double kLoadRanges[] = {0.5, 0.8, 0.9, 0.95, 1.0};
+const size_t kNumRanges = sizeof(kLoadRanges) / sizeof(kLoadRanges[0]);
+
+// histogram buckets are powers of two of nanoseconds, from 2^6 to 2^16
+const size_t kMinLog = 6;
+const size_t kMaxLog = 16;
+
+struct Range {
+  std::vector<uint32_t> ns;
+  size_t writes = 0;
+};
+
+uint32_t Percentile(const std::vector<uint32_t> &sorted, double p) {
+  return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+void Run(const std::string &name, cuckoofilter::InsertStrategy strategy,
+         size_t total_items) {
+  Filter filter(total_items);
+  filter.SetInsertStrategy(strategy);
+
+  Range ranges[kNumRanges];
+  size_t range = 0;
+  for (uint64_t i = 0;; i++) {
+    while (range + 1 < kNumRanges && filter.Load() >= kLoadRanges[range]) {
+      range++;
+    }
+    size_t before = filter.Size();
+    size_t writes = tag_writes;
+    uint64_t start = NowNanos();
+    filter.Add(Key(i));
+    uint64_t ns = NowNanos() - start;
+    if (filter.Size() == before) {
+      break;
+    }
+    ranges[range].ns.push_back(std::min<uint64_t>(ns, UINT32_MAX));
+    ranges[range].writes += tag_writes - writes;
+  }
+
+  std::cout << name << ", " << total_items << " items, filled to "
+            << std::setprecision(4) << 100 * filter.Load() << "%\n";
+  std::cout << std::setw(10) << "load" << std::setw(10) << "inserts"
+            << std::setw(8) << "p50" << std::setw(8) << "p99"
+            << std::setw(8) << "p99.9" << std::setw(9) << "max"
+            << std::setw(9) << "writes" << "   histogram (<2^" << kMinLog
+            << ", ..., >=2^" << kMaxLog << " ns)\n";
+  double low = 0;
+  for (size_t r = 0; r < kNumRanges; low = kLoadRanges[r], r++) {
+    std::vector<uint32_t> &ns = ranges[r].ns;
+    if (ns.empty()) {
+      continue;
+    }
+    std::vector<size_t> histogram(kMaxLog - kMinLog + 2);
+    for (uint32_t v : ns) {
+      size_t log = 0;
+      while (log < 32 && (1ULL << (log + 1)) <= v) {
+        log++;
+      }
+      histogram[std::min(std::max(log + 1, kMinLog), kMaxLog + 1) - kMinLog]++;
+    }
+    std::sort(ns.begin(), ns.end());
+    std::cout << std::setw(4) << (int)(100 * low) << "-" << std::setw(3)
+              << std::left << (int)(100 * kLoadRanges[r]) << std::right
+              << "%" << std::setw(10) << ns.size() << std::setw(8)
+              << Percentile(ns, 0.5) << std::setw(8) << Percentile(ns, 0.99)
+              << std::setw(8) << Percentile(ns, 0.999) << std::setw(9)
+              << ns.back() << std::setw(9) << std::fixed
+              << std::setprecision(2) << 1.0 * ranges[r].writes / ns.size()
+              << std::defaultfloat << "  ";
+    for (size_t count : histogram) {
+      std::cout << " " << count;
+    }
+    std::cout << "\n";
+  }
+  std::cout << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  std::vector<size_t> counts = cuckoofilter::bench::ParseCounts(
+      argc, argv, {1000 * 1000, 100 * 1000 * 1000});
+  for (size_t total_items : counts) {
+    Run("random walk", cuckoofilter::kRandomWalk, total_items);
+    Run("breadth-first", cuckoofilter::kBreadthFirst, total_items);
+  }
+  return 0;
+}
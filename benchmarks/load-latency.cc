@@ -0,0 +1,120 @@
+// Measures how soon a saved filter answers its first query, and how soon it
+// is fully resident, when it is read into memory by CuckooFilter, mapped and
+// populated by MappedCuckooFilter, copied by MappedCuckooFilter on several
+// threads, and mapped and faulted in on background threads. The file is
+// evicted from the page cache before each load, so the loads read the disk.
+//
+// Usage: load-latency [item_count] [load_threads] [path]
+//   item_count accepts K/M/B suffixes and defaults to 200M; load_threads
+//   defaults to 4. The filter is saved to path, /tmp/load-latency.filter by
+//   default, and removed at the end.
+
+#include "mappedcuckoofilter.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::MapOptions;
+using cuckoofilter::MappedCuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+typedef CuckooFilter<uint64_t, 12> Filter;
+typedef MappedCuckooFilter<uint64_t, 12> MappedFilter;
+
+// Drops the file's pages from the page cache
+void Evict(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+void Print(const std::string &name, uint64_t first_ns, uint64_t resident_ns,
+           bool ok) {
+  std::cout << std::setw(16) << name << std::setw(18) << std::fixed
+            << std::setprecision(2) << first_ns / 1e6 << std::setw(14)
+            << resident_ns / 1e6 << (ok ? "" : "  failed") << "\n";
+}
+
+void TimeMapped(const std::string &name, const std::string &path,
+                const MapOptions &options) {
+  Evict(path);
+  uint64_t start = NowNanos();
+  MappedFilter filter(path, options);
+  bool ok = filter.Valid() && filter.Contain(Key(0)) == cuckoofilter::Ok;
+  uint64_t first_ns = NowNanos() - start;
+  ok = filter.Ready().get() && ok;
+  Print(name, first_ns, NowNanos() - start, ok);
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 200 * 1000 * 1000;
+  size_t load_threads = 4;
+  std::string path = "/tmp/load-latency.filter";
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    load_threads = std::stoul(argv[2]);
+  }
+  if (argc > 3) {
+    path = argv[3];
+  }
+
+  {
+    Filter filter(total_items);
+    for (size_t i = 0; i < total_items; i++) {
+      filter.Add(Key(i));
+    }
+    if (!filter.Save(path)) {
+      std::cout << "Failed to save " << path << "\n";
+      return 1;
+    }
+    std::cout << total_items << " items, " << filter.SizeInBytes()
+              << " bytes, " << load_threads << " load threads\n";
+  }
+
+  std::cout << std::setw(16) << "load" << std::setw(18) << "first query ms"
+            << std::setw(14) << "resident ms\n";
+
+  Evict(path);
+  uint64_t start = NowNanos();
+  {
+    Filter filter(path);
+    bool ok = filter.Valid() && filter.Contain(Key(0)) == cuckoofilter::Ok;
+    uint64_t ns = NowNanos() - start;
+    Print("read", ns, ns, ok);
+  }
+
+  MapOptions options;
+  options.populate = true;
+  TimeMapped("map populate", path, options);
+
+  options = MapOptions();
+  options.huge_pages = cuckoofilter::kCopyToHugePages;
+  options.load_threads = load_threads;
+  TimeMapped("copy", path, options);
+
+  options = MapOptions();
+  options.background = true;
+  options.load_threads = load_threads;
+  TimeMapped("map background", path, options);
+
+  remove(path.c_str());
+  return 0;
+}
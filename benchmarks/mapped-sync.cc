@@ -0,0 +1,97 @@
+// Measures persisting a few updates to a large filter: Save, which writes
+// the whole file, against a writable MappedCuckooFilter, whose Sync writes
+// back only the pages the updates touched.
+//
+// Usage: mapped-sync [item_count] [update_count] [path]
+//   item_count accepts K/M/B suffixes and defaults to 200M, update_count
+//   defaults to 5000; the filter is saved to path,
+//   /tmp/mapped-sync.filter by default, and removed at the end.
+
+#include "mappedcuckoofilter.h"
+
+#include <stdio.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::MapOptions;
+using cuckoofilter::MappedCuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+void Print(const std::string &name, uint64_t ns) {
+  std::cout << std::setw(24) << name << std::setw(12) << std::fixed
+            << std::setprecision(2) << ns / 1e6 << " ms\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 200 * 1000 * 1000;
+  size_t num_updates = 5000;
+  std::string path = "/tmp/mapped-sync.filter";
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    num_updates = cuckoofilter::bench::ParseCount(argv[2]);
+  }
+  if (argc > 3) {
+    path = argv[3];
+  }
+
+  // Leave room for the updates
+  const size_t num_items = total_items * 9 / 10;
+  {
+    CuckooFilter<uint64_t, 12> filter(total_items);
+    for (size_t i = 0; i < num_items; i++) {
+      filter.Add(Key(i));
+    }
+    std::cout << num_items << " items, " << filter.SizeInBytes()
+              << " bytes, " << num_updates << " updates\n";
+
+    for (size_t i = num_items; i < num_items + num_updates; i++) {
+      filter.Add(Key(i));
+    }
+    uint64_t start = NowNanos();
+    if (!filter.Save(path)) {
+      std::cout << "Failed to save " << path << "\n";
+      return 1;
+    }
+    Print("Save", NowNanos() - start);
+  }
+
+  MapOptions options;
+  options.writable = true;
+  MappedCuckooFilter<uint64_t, 12> filter(path, options);
+  if (!filter.Valid()) {
+    std::cout << filter.Error() << "\n";
+    return 1;
+  }
+  // Start from a clean file, as Save left it fully written back
+  filter.Sync();
+
+  uint64_t start = NowNanos();
+  for (size_t i = num_items + num_updates; i < num_items + 2 * num_updates;
+       i++) {
+    filter.Add(Key(i));
+  }
+  Print("updates", NowNanos() - start);
+
+  start = NowNanos();
+  filter.Sync();
+  Print("Sync", NowNanos() - start);
+
+  start = NowNanos();
+  filter.Sync(true);
+  Print("Sync with checksum", NowNanos() - start);
+
+  remove(path.c_str());
+  return 0;
+}
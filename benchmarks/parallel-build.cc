@@ -0,0 +1,105 @@
+// Measures building a filter with ParallelBuild and with BulkBuild on 1, 2,
+// 4, ... threads against adding the same keys to one seeded filter, and
+// checks that every build finds all of its keys.
+//
+// Usage: parallel-build [item_count] [max_threads]
+//   item_count accepts K/M/B suffixes and defaults to 100M; max_threads
+//   defaults to the number of hardware threads. The filter is sized for
+//   item_count keys, so it ends up about 95% full.
+
+#include "parallelbuild.h"
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::ParallelBuild;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+typedef CuckooFilter<uint64_t, 12> Filter;
+
+const uint64_t kSeed = 0x5eed;
+
+size_t CountMissing(const Filter &filter, const std::vector<uint64_t> &keys) {
+  size_t missing = 0;
+  for (uint64_t key : keys) {
+    missing += (filter.Contain(key) != cuckoofilter::Ok);
+  }
+  return missing;
+}
+
+void Print(const std::string &name, uint64_t ns, uint64_t serial_ns,
+           size_t missing) {
+  std::cout << std::setw(12) << name << std::setw(10) << std::fixed
+            << std::setprecision(2) << ns / 1e9 << std::setw(10)
+            << 1.0 * serial_ns / ns << std::setw(10) << missing << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 100 * 1000 * 1000;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    max_threads = std::stoul(argv[2]);
+  }
+
+  std::vector<uint64_t> keys(total_items);
+  for (size_t i = 0; i < total_items; i++) {
+    keys[i] = Key(i);
+  }
+
+  std::cout << total_items << " items\n"
+            << std::setw(12) << "build" << std::setw(10) << "seconds"
+            << std::setw(10) << "speedup" << std::setw(10) << "missing\n";
+
+  uint64_t start = NowNanos();
+  std::unique_ptr<Filter> serial(new Filter(total_items, kSeed));
+  for (uint64_t key : keys) {
+    serial->Add(key);
+  }
+  uint64_t serial_ns = NowNanos() - start;
+  Print("serial", serial_ns, serial_ns, CountMissing(*serial, keys));
+  serial.reset();
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    cuckoofilter::Status status;
+    start = NowNanos();
+    std::unique_ptr<Filter> filter = ParallelBuild<Filter>(
+        keys.data(), keys.size(), total_items, kSeed, threads, &status);
+    uint64_t ns = NowNanos() - start;
+    if (!filter) {
+      std::cout << "out of memory at " << threads << " threads\n";
+      break;
+    }
+    if (status != cuckoofilter::Ok) {
+      std::cout << "filter full at " << threads << " threads\n";
+    }
+    Print("shard " + std::to_string(threads), ns, serial_ns,
+          CountMissing(*filter, keys));
+    filter.reset();
+
+    start = NowNanos();
+    filter.reset(new Filter(total_items, kSeed));
+    status = filter->BulkBuild(keys.data(), keys.size(), threads);
+    ns = NowNanos() - start;
+    if (status != cuckoofilter::Ok) {
+      std::cout << "filter full at " << threads << " threads\n";
+    }
+    Print("bulk " + std::to_string(threads), ns, serial_ns,
+          CountMissing(*filter, keys));
+  }
+  return 0;
+}
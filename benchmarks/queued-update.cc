@@ -0,0 +1,166 @@
+// Measures sustained update throughput of QueuedCuckooFilter against a
+// CuckooFilter behind a mutex, for 1, 2, 4, ... producer threads. Each thread
+// adds its share of the keys and then deletes a quarter of them; the time of
+// the queued filter runs until Flush returns, so every update is applied.
+//
+// Usage: queued-update [item_count] [num_appliers] [max_threads]
+//   item_count accepts K/M/B suffixes and defaults to 50M; num_appliers
+//   defaults to 1 and max_threads to the number of hardware threads.
+
+#include "queuedcuckoofilter.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::QueueOptions;
+using cuckoofilter::QueuedCuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+typedef QueuedCuckooFilter<uint64_t, 12> QueuedFilter;
+
+// The baseline: every operation takes one global lock
+class MutexFilter {
+  CuckooFilter<uint64_t, 12> filter_;
+  std::mutex mutex_;
+
+ public:
+  explicit MutexFilter(size_t max_num_keys) : filter_(max_num_keys) {}
+
+  cuckoofilter::Status Add(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Add(key);
+  }
+
+  cuckoofilter::Status Contain(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Contain(key);
+  }
+
+  cuckoofilter::Status Delete(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Delete(key);
+  }
+};
+
+// Keys [begin, end) of thread t of num_threads, out of n
+size_t Begin(size_t n, size_t t, size_t num_threads) {
+  return n * t / num_threads;
+}
+
+// Run the updates of num_threads threads, update(t, i, add) making one, and
+// return the millions of updates per second. finish runs once the threads
+// are done, within the time.
+template <typename Update, typename Finish>
+double TimeUpdates(size_t n, size_t num_threads, const Update &update,
+                   const Finish &finish) {
+  std::vector<std::thread> threads;
+  uint64_t start = NowNanos();
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&update, n, num_threads, t] {
+      const size_t begin = Begin(n, t, num_threads);
+      const size_t end = Begin(n, t + 1, num_threads);
+      for (size_t i = begin; i < end; i++) {
+        update(t, i, true);
+      }
+      for (size_t i = begin; i < begin + (end - begin) / 4; i++) {
+        update(t, i, false);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  finish();
+  uint64_t ns = NowNanos() - start;
+  return 1e3 * (n + n / 4) / ns;
+}
+
+// Count the keys that should be in the filter and are not
+template <typename Filter>
+size_t CountMissing(Filter *filter, size_t n, size_t num_threads) {
+  size_t missing = 0;
+  for (size_t t = 0; t < num_threads; t++) {
+    const size_t begin = Begin(n, t, num_threads);
+    const size_t end = Begin(n, t + 1, num_threads);
+    for (size_t i = begin + (end - begin) / 4; i < end; i++) {
+      missing += (filter->Contain(Key(i)) != cuckoofilter::Ok);
+    }
+  }
+  return missing;
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 50 * 1000 * 1000;
+  QueueOptions options;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    options.num_appliers = std::stoul(argv[2]);
+  }
+  if (argc > 3) {
+    max_threads = std::stoul(argv[3]);
+  }
+
+  // Fill the filters to about 90%
+  const size_t num_items = total_items * 9 / 10;
+  std::cout << num_items << " items, " << options.num_appliers
+            << " appliers\n"
+            << std::setw(8) << "threads" << std::setw(14) << "mutex Mops"
+            << std::setw(14) << "queued Mops" << std::setw(10) << "missing"
+            << std::setw(10) << "failed\n";
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    std::unique_ptr<MutexFilter> mutex_filter(new MutexFilter(total_items));
+    double mutex_mops = TimeUpdates(
+        num_items, threads,
+        [&mutex_filter](size_t, size_t i, bool add) {
+          if (add) {
+            mutex_filter->Add(Key(i));
+          } else {
+            mutex_filter->Delete(Key(i));
+          }
+        },
+        [] {});
+    size_t missing = CountMissing(mutex_filter.get(), num_items, threads);
+    mutex_filter.reset();
+
+    QueuedFilter queued(total_items, options);
+    std::vector<std::unique_ptr<QueuedFilter::Producer>> producers;
+    for (size_t t = 0; t < threads; t++) {
+      producers.emplace_back(new QueuedFilter::Producer(&queued));
+    }
+    double queued_mops = TimeUpdates(
+        num_items, threads,
+        [&producers](size_t t, size_t i, bool add) {
+          if (add) {
+            producers[t]->Add(Key(i));
+          } else {
+            producers[t]->Delete(Key(i));
+          }
+        },
+        [&queued] { queued.Flush(); });
+    producers.clear();
+    missing += CountMissing(&queued, num_items, threads);
+
+    std::cout << std::setw(8) << threads << std::setw(14) << std::fixed
+              << std::setprecision(2) << mutex_mops << std::setw(14)
+              << queued_mops << std::setw(10) << missing << std::setw(9)
+              << queued.Failures() << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+// Measures building a global filter from per-tenant filters with Merge, and
+// removing a tenant with Subtract, against adding and deleting the same
+// keys one by one, on 1, 2, 4, ... threads.
+//
+// Usage: set-ops [item_count] [tenant_count] [max_threads]
+//   item_count accepts K/M/B suffixes and defaults to 100M keys split evenly
+//   across tenant_count tenants, 8 by default; max_threads defaults to the
+//   number of hardware threads.
+
+#include "cuckoofilter.h"
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+typedef CuckooFilter<uint64_t, 12> Filter;
+
+const uint64_t kSeed = 0x5eed;
+
+void Print(const std::string &name, uint64_t ns, size_t num_keys) {
+  std::cout << std::setw(14) << name << std::setw(12) << std::fixed
+            << std::setprecision(1) << ns / 1e6 << std::setw(12)
+            << std::setprecision(2) << 1e3 * num_keys / ns << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 100 * 1000 * 1000;
+  size_t num_tenants = 8;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    num_tenants = std::stoul(argv[2]);
+  }
+  if (argc > 3) {
+    max_threads = std::stoul(argv[3]);
+  }
+
+  // The tenants' filters are as large as the global one, as Merge needs
+  const size_t per_tenant = total_items / num_tenants;
+  std::vector<std::unique_ptr<Filter>> tenants;
+  for (size_t t = 0; t < num_tenants; t++) {
+    tenants.emplace_back(new Filter(total_items, kSeed));
+    for (size_t i = t * per_tenant; i < (t + 1) * per_tenant; i++) {
+      tenants[t]->Add(Key(i));
+    }
+  }
+  std::cout << num_tenants << " tenants of " << per_tenant << " items\n"
+            << std::setw(14) << "operation" << std::setw(12) << "ms"
+            << std::setw(12) << "Mkeys/s\n";
+
+  Filter added(total_items, kSeed);
+  uint64_t start = NowNanos();
+  for (size_t i = 0; i < num_tenants * per_tenant; i++) {
+    added.Add(Key(i));
+  }
+  Print("add", NowNanos() - start, num_tenants * per_tenant);
+
+  start = NowNanos();
+  for (size_t i = 0; i < per_tenant; i++) {
+    added.Delete(Key(i));
+  }
+  Print("delete", NowNanos() - start, per_tenant);
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    Filter global(total_items, kSeed);
+    start = NowNanos();
+    for (const std::unique_ptr<Filter> &tenant : tenants) {
+      if (global.Merge(*tenant, threads) != cuckoofilter::Ok) {
+        std::cout << "merge failed\n";
+        return 1;
+      }
+    }
+    Print("merge " + std::to_string(threads), NowNanos() - start,
+          num_tenants * per_tenant);
+
+    start = NowNanos();
+    if (global.Subtract(*tenants[0], threads) != cuckoofilter::Ok) {
+      std::cout << "subtract failed\n";
+      return 1;
+    }
+    Print("subtract " + std::to_string(threads), NowNanos() - start,
+          per_tenant);
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Measures insert throughput of ShardedCuckooFilter against a CuckooFilter
+// behind a mutex, for 1, 2, 4, ... writer threads each adding its share of
+// the keys, and checks that every key is found afterwards.
+//
+// Usage: sharded-insert [item_count] [num_shards] [max_threads]
+//   item_count accepts K/M/B suffixes and defaults to 50M; num_shards
+//   defaults to 64 and max_threads to the number of hardware threads.
+
+#include "shardedcuckoofilter.h"
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::ShardedCuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+// The baseline: every operation takes one global lock
+class MutexFilter {
+  CuckooFilter<uint64_t, 12> filter_;
+  std::mutex mutex_;
+
+ public:
+  explicit MutexFilter(size_t max_num_keys) : filter_(max_num_keys) {}
+
+  cuckoofilter::Status Add(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Add(key);
+  }
+
+  cuckoofilter::Status Contain(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return filter_.Contain(key);
+  }
+};
+
+// Add keys [0, n) from num_threads threads and return the millions of keys
+// added per second, and the number of keys not found afterwards
+template <typename Filter>
+double TimeAdds(Filter *filter, size_t n, size_t num_threads,
+                size_t *missing) {
+  std::vector<std::thread> threads;
+  uint64_t start = NowNanos();
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([filter, n, num_threads, t] {
+      for (size_t i = n * t / num_threads; i < n * (t + 1) / num_threads;
+           i++) {
+        filter->Add(Key(i));
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  uint64_t ns = NowNanos() - start;
+
+  *missing = 0;
+  for (size_t i = 0; i < n; i++) {
+    *missing += (filter->Contain(Key(i)) != cuckoofilter::Ok);
+  }
+  return 1e3 * n / ns;
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t total_items = 50 * 1000 * 1000;
+  size_t num_shards = 64;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    total_items = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    num_shards = std::stoul(argv[2]);
+  }
+  if (argc > 3) {
+    max_threads = std::stoul(argv[3]);
+  }
+
+  // Fill the filters to about 90%
+  const size_t num_items = total_items * 9 / 10;
+  std::cout << num_items << " items, " << num_shards << " shards\n"
+            << std::setw(8) << "threads" << std::setw(14) << "mutex Mops"
+            << std::setw(14) << "sharded Mops" << std::setw(10) << "missing\n";
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    size_t mutex_missing, sharded_missing;
+    std::unique_ptr<MutexFilter> mutex_filter(new MutexFilter(total_items));
+    double mutex_mops =
+        TimeAdds(mutex_filter.get(), num_items, threads, &mutex_missing);
+    mutex_filter.reset();
+
+    std::unique_ptr<ShardedCuckooFilter<uint64_t, 12>> sharded(
+        new ShardedCuckooFilter<uint64_t, 12>(total_items, num_shards));
+    double sharded_mops =
+        TimeAdds(sharded.get(), num_items, threads, &sharded_missing);
+
+    std::cout << std::setw(8) << threads << std::setw(14) << std::fixed
+              << std::setprecision(2) << mutex_mops << std::setw(14)
+              << sharded_mops << std::setw(9)
+              << mutex_missing + sharded_missing << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+// Compares SingleTable, BlockedTable and PackedTable on false positive rate, insert and
+// lookup throughput.
+//
+// Usage: table-compare [item_count ...]
+//   item_count accepts K/M/B suffixes and defaults to 1M 100M. Filters many
+//   times the size of the last level cache show the difference in cache line
+//   fills per lookup.
+
+#include "cuckoofilter.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::BlockedTable;
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::PackedTable;
+using cuckoofilter::SingleTable;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+const size_t kMaxQueries = 10 * 1000 * 1000;
+
+template <size_t bits, template <size_t> class TableType>
+void Run(const std::string &name, size_t total_items) {
+  CuckooFilter<uint64_t, bits, TableType> filter(total_items);
+  if (!filter.Valid()) {
+    std::cout << "Failed to allocate a filter for " << total_items
+              << " items\n";
+    return;
+  }
+
+  uint64_t start = NowNanos();
+  size_t added = 0;
+  for (; added < total_items; added++) {
+    if (filter.Add(Key(added)) != cuckoofilter::Ok) {
+      break;
+    }
+  }
+  uint64_t add_ns = NowNanos() - start;
+
+  // Random probes, so that every lookup is a cache miss on large filters
+  size_t num_queries = std::min(kMaxQueries, added);
+  std::vector<uint64_t> hits(num_queries), misses(num_queries);
+  for (size_t q = 0; q < num_queries; q++) {
+    hits[q] = Key(Key(~q) % added);
+    misses[q] = Key(total_items + q);
+  }
+
+  size_t found = 0;
+  start = NowNanos();
+  for (size_t q = 0; q < num_queries; q++) {
+    found += (filter.Contain(hits[q]) == cuckoofilter::Ok);
+  }
+  uint64_t hit_ns = NowNanos() - start;
+
+  size_t false_positives = 0;
+  start = NowNanos();
+  for (size_t q = 0; q < num_queries; q++) {
+    false_positives += (filter.Contain(misses[q]) == cuckoofilter::Ok);
+  }
+  uint64_t miss_ns = NowNanos() - start;
+
+  if (found != num_queries) {
+    std::cout << "False negatives seen with " << name << "\n";
+  }
+  std::cout << std::setw(12) << name << std::setw(6) << bits << std::setw(12)
+            << total_items << std::fixed << std::setprecision(2)
+            << std::setw(10) << 8.0 * filter.SizeInBytes() / added
+            << std::setprecision(4) << std::setw(10)
+            << 100.0 * false_positives / num_queries << std::setprecision(2)
+            << std::setw(10) << 1.0 * add_ns / added << std::setw(10)
+            << 1.0 * hit_ns / num_queries << std::setw(10)
+            << 1.0 * miss_ns / num_queries << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  std::vector<size_t> counts = cuckoofilter::bench::ParseCounts(
+      argc, argv, {1000000, 100000000});
+  std::cout << std::setw(12) << "table" << std::setw(6) << "bits"
+            << std::setw(12) << "items" << std::setw(10) << "bits/key"
+            << std::setw(10) << "fpp %" << std::setw(10) << "add ns"
+            << std::setw(10) << "hit ns" << std::setw(10) << "miss ns"
+            << "\n";
+  for (size_t n : counts) {
+    Run<8, SingleTable>("single", n);
+    Run<8, BlockedTable>("blocked", n);
+    Run<12, SingleTable>("single", n);
+    Run<12, BlockedTable>("blocked", n);
+    Run<13, PackedTable>("packed", n);
+    Run<16, SingleTable>("single", n);
+    Run<16, BlockedTable>("blocked", n);
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Compares two ways to filter string keys of URL length: hashing them to
+// integers first and adding those to a CuckooFilter<uint64_t>, which reads
+// every key once to hash it and hashes the result again, and adding them to
+// a CuckooFilter<std::string, ..., WyHash> directly.
+//
+// Usage: url-keys [item_count ...]
+//   item_count accepts K/M/B suffixes and defaults to 1M 10M.
+
+#include "cuckoofilter.h"
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::SingleTable;
+using cuckoofilter::WyHash;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+const size_t kMaxQueries = 10 * 1000 * 1000;
+
+// A URL of 30 to 130 bytes made from the bits of key i, such as
+// https://www.k3f9a.com/2c/7d1e0/b?id=51f
+std::string Url(uint64_t i) {
+  static const char kDigits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+  uint64_t h = Key(i);
+  std::string url = "https://www.";
+  for (size_t c = 4 + h % 12; c > 0; c--, h /= 36) {
+    url += kDigits[h % 36];
+  }
+  url += ".com";
+  uint64_t g = Key(h ^ i);
+  for (size_t segment = g % 6; segment > 0; segment--) {
+    url += '/';
+    g = Key(g);
+    for (size_t c = 2 + g % 14; c > 0; c--, g /= 36) {
+      url += kDigits[g % 36];
+    }
+  }
+  url += "?id=" + std::to_string(Key(~i) % 1000000007);
+  return url;
+}
+
+// pre-hashes keys with std::hash, as callers had to
+struct PreHashed {
+  CuckooFilter<uint64_t, 12> filter;
+  std::hash<std::string> hash;
+  explicit PreHashed(size_t total_items) : filter(total_items) {}
+  cuckoofilter::Status Add(const std::string &key) {
+    return filter.Add(hash(key));
+  }
+  cuckoofilter::Status Contain(const std::string &key) const {
+    return filter.Contain(hash(key));
+  }
+};
+
+struct Direct {
+  CuckooFilter<std::string, 12, SingleTable, WyHash> filter;
+  explicit Direct(size_t total_items) : filter(total_items) {}
+  cuckoofilter::Status Add(const std::string &key) { return filter.Add(key); }
+  cuckoofilter::Status Contain(const std::string &key) const {
+    return filter.Contain(key);
+  }
+};
+
+template <typename FilterType>
+void Run(const std::string &name, const std::vector<std::string> &keys,
+         const std::vector<std::string> &queries, size_t total_items) {
+  FilterType filter(total_items);
+  uint64_t start = NowNanos();
+  for (const std::string &key : keys) {
+    filter.Add(key);
+  }
+  uint64_t add_ns = NowNanos() - start;
+
+  size_t found = 0;
+  start = NowNanos();
+  for (const std::string &key : queries) {
+    found += (filter.Contain(key) == cuckoofilter::Ok);
+  }
+  uint64_t contain_ns = NowNanos() - start;
+
+  std::cout << std::setw(12) << name << std::setw(10) << std::fixed
+            << std::setprecision(1) << 1.0 * add_ns / keys.size()
+            << std::setw(12) << 1.0 * contain_ns / queries.size()
+            << std::setw(10) << std::setprecision(3)
+            << 100.0 * found / queries.size() << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  std::vector<size_t> counts = cuckoofilter::bench::ParseCounts(
+      argc, argv, {1000 * 1000, 10 * 1000 * 1000});
+
+  for (size_t total_items : counts) {
+    std::vector<std::string> keys(total_items);
+    size_t bytes = 0;
+    for (size_t i = 0; i < total_items; i++) {
+      keys[i] = Url(i);
+      bytes += keys[i].size();
+    }
+    // Half hits, half misses
+    size_t num_queries = std::min(kMaxQueries, total_items);
+    std::vector<std::string> queries(num_queries);
+    for (size_t q = 0; q < num_queries; q++) {
+      queries[q] = (q & 1) ? Url(total_items + q) : keys[Key(q) % total_items];
+    }
+
+    std::cout << total_items << " URLs of " << std::setprecision(1)
+              << std::fixed << 1.0 * bytes / total_items
+              << " bytes on average\n"
+              << std::setw(12) << "keys" << std::setw(10) << "add ns"
+              << std::setw(12) << "contain ns" << std::setw(10) << "found %\n";
+    Run<PreHashed>("pre-hashed", keys, queries, total_items);
+    Run<Direct>("WyHash", keys, queries, total_items);
+    std::cout << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+// Adds a Zipf distributed stream of keys, as flow keys are, to a CuckooFilter
+// and to a CountingCuckooFilter sized for the number of distinct keys, and
+// reports how full each gets and how many Adds fail.
+//
+// Usage: zipf-count [distinct_keys] [stream_length] [exponent]
+//   distinct_keys and stream_length accept K/M/B suffixes and default to 1M
+//   and 10M; exponent defaults to 1.0.
+
+#include "countingcuckoofilter.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchutil.h"
+
+using cuckoofilter::CountingCuckooFilter;
+using cuckoofilter::CuckooFilter;
+using cuckoofilter::bench::Key;
+using cuckoofilter::bench::NowNanos;
+
+namespace {
+
+// Key ranks drawn from a Zipf distribution over distinct_keys keys
+std::vector<uint32_t> ZipfStream(size_t distinct_keys, size_t length,
+                                 double exponent) {
+  std::vector<double> cdf(distinct_keys);
+  double sum = 0;
+  for (size_t r = 0; r < distinct_keys; r++) {
+    sum += 1.0 / pow(r + 1, exponent);
+    cdf[r] = sum;
+  }
+  std::mt19937_64 random(42);
+  std::uniform_real_distribution<double> uniform(0, sum);
+  std::vector<uint32_t> stream(length);
+  for (size_t i = 0; i < length; i++) {
+    stream[i] = std::lower_bound(cdf.begin(), cdf.end(), uniform(random)) -
+                cdf.begin();
+  }
+  return stream;
+}
+
+template <typename FilterType>
+void Run(const std::string &name, size_t distinct_keys,
+         const std::vector<uint32_t> &stream) {
+  FilterType filter(distinct_keys);
+  size_t failed = 0;
+  uint64_t start = NowNanos();
+  for (uint32_t rank : stream) {
+    failed += (filter.Add(Key(rank)) != cuckoofilter::Ok);
+  }
+  uint64_t add_ns = NowNanos() - start;
+
+  std::cout << std::setw(10) << name << std::setw(12) << filter.Size()
+            << std::setw(10) << std::fixed << std::setprecision(2)
+            << 100 * filter.LoadFactor() << std::setw(12) << failed
+            << std::setw(10) << std::setprecision(1)
+            << 1.0 * add_ns / stream.size() << "\n";
+}
+
+}  // namespace
+
+int main(int argc, const char **argv) {
+  size_t distinct_keys = 1000 * 1000;
+  size_t length = 10 * 1000 * 1000;
+  double exponent = 1.0;
+  if (argc > 1) {
+    distinct_keys = cuckoofilter::bench::ParseCount(argv[1]);
+  }
+  if (argc > 2) {
+    length = cuckoofilter::bench::ParseCount(argv[2]);
+  }
+  if (argc > 3) {
+    exponent = std::stod(argv[3]);
+  }
+
+  std::vector<uint32_t> stream = ZipfStream(distinct_keys, length, exponent);
+  std::vector<uint32_t> seen(stream);
+  std::sort(seen.begin(), seen.end());
+  size_t distinct = std::unique(seen.begin(), seen.end()) - seen.begin();
+  std::cout << length << " Adds of " << distinct << " distinct keys, Zipf "
+            << exponent << "\n";
+
+  std::cout << std::setw(10) << "filter" << std::setw(12) << "tags"
+            << std::setw(10) << "load %" << std::setw(12) << "failed"
+            << std::setw(10) << "add ns\n";
+  Run<CuckooFilter<uint64_t, 12>>("plain", distinct_keys, stream);
+  Run<CountingCuckooFilter<uint64_t, 12>>("counting", distinct_keys, stream);
+  return 0;
+}
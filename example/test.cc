@@ -1,7 +1,10 @@
 #include "cuckoofilter.h"
+#include "mappedcuckoofilter.h"
+#include "resizablecuckoofilter.h"
 
 #include <assert.h>
 #include <math.h>
+#include <stdio.h>
 
 #include <iostream>
 #include <iomanip>
@@ -15,17 +18,59 @@
 #include <unistd.h>
 
 using cuckoofilter::CuckooFilter;
+using cuckoofilter::MappedCuckooFilter;
 using cuckoofilter::BaseCuckooFilter;
+using cuckoofilter::ResizableCuckooFilter;
 
 void usage()
 {
   printf("Usage: test [item_count] [bits_per_item] [fp_mult]\n");
   printf("  where item_count is the number of items to add to the filter\n");
-  printf("        bits_per_item is the number of bits to allocate per item (2, 4, 8, 12, 16, or 32)\n");
+  printf("        bits_per_item is the number of bits to allocate per item (2 to 32)\n");
   printf("        fp_mult is the number of false positives to test for as a multiple of item_count (e.g. 3)\n");
   exit(-1);
 }
 
+// Where a filter of the test comes from
+enum Source { kNew, kFile, kMemory, kMapped };
+
+struct FilterArgs {
+  size_t total_items;
+  std::string filename;
+  void *data;
+  size_t size;
+  cuckoofilter::MapOptions options;
+};
+
+template <size_t bits>
+BaseCuckooFilter<size_t> *make_filter(Source source, const FilterArgs &args)
+{
+  switch(source) {
+    case kNew: return new CuckooFilter<size_t, bits>(args.total_items);
+    case kFile: return new CuckooFilter<size_t, bits>(args.filename);
+    case kMemory: return new CuckooFilter<size_t, bits>(args.data, args.size);
+    case kMapped: return new MappedCuckooFilter<size_t, bits>(args.filename, args.options);
+  }
+  return nullptr;
+}
+
+// Make the filter of bits_per_item bits from source, trying each width from
+// bits up to 32; nullptr if bits_per_item is none of them
+template <size_t bits>
+BaseCuckooFilter<size_t> *new_filter(size_t bits_per_item, Source source, const FilterArgs &args)
+{
+  if (bits_per_item == bits) {
+    return make_filter<bits>(source, args);
+  }
+  return new_filter<bits + 1>(bits_per_item, source, args);
+}
+
+template <>
+BaseCuckooFilter<size_t> *new_filter<33>(size_t, Source, const FilterArgs &)
+{
+  return nullptr;
+}
+
 bool run_adds(BaseCuckooFilter<size_t> *filter, size_t total_items)
 {
   auto start = std::chrono::high_resolution_clock::now();
@@ -70,6 +115,131 @@ bool run_contains(BaseCuckooFilter<size_t> *filter, size_t total_items, size_t f
   std::cout << "false queries: " << false_queries << ", total_queries: " << total_queries << "\n";
   std::cout << std::fixed << "false positive rate is "
             << 100.0 * false_queries / total_queries << "%\n";
+
+  // The batched lookup must agree with the per-key one on every key
+  const size_t kBatch = 1024;
+  size_t keys[kBatch];
+  uint8_t results[kBatch];
+  size_t batch_false_queries = 0;
+  for (size_t i = 0; i < (fp_mult + 1) * total_items; i += kBatch) {
+    size_t n = std::min(kBatch, (fp_mult + 1) * total_items - i);
+    for (size_t k = 0; k < n; k++) {
+      keys[k] = i + k;
+    }
+    filter->ContainBatch(keys, n, results);
+    for (size_t k = 0; k < n; k++) {
+      if (keys[k] < total_items && results[k] != cuckoofilter::Ok) {
+        std::cout << "Batched false negative seen at index " << keys[k] << std::endl;
+        return false;
+      }
+      if (keys[k] >= total_items && results[k] == cuckoofilter::Ok) {
+        batch_false_queries++;
+      }
+    }
+  }
+  if (batch_false_queries != false_queries) {
+    std::cout << "Batched lookup saw " << batch_false_queries
+              << " false queries, expected " << false_queries << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+// Bulk build half the items into one resizable filter and merge the other
+// half in from another, after doubling both; the tags they copy must keep
+// the index bits reserved for their buckets
+bool run_resizable(size_t total_items)
+{
+  typedef ResizableCuckooFilter<size_t, 12, 4> Resizable;
+  std::vector<size_t> keys(total_items);
+  for (size_t i = 0; i < total_items; i++) {
+    keys[i] = i;
+  }
+
+  const uint64_t seed = 42;
+  Resizable built(total_items, seed), other(total_items, seed);
+  if (built.BulkBuild(keys.data(), total_items / 2) != cuckoofilter::Ok) {
+    std::cout << "failed to bulk build the resizable filter\n";
+    return false;
+  }
+  for (size_t i = total_items / 2; i < total_items; i++) {
+    if (other.Add(i) != cuckoofilter::Ok) {
+      std::cout << "failed to insert item " << i << "\n";
+      return false;
+    }
+  }
+  if (!built.Resize() || !other.Resize() ||
+      built.Merge(other) != cuckoofilter::Ok) {
+    std::cout << "failed to merge the resizable filters\n";
+    return false;
+  }
+  for (size_t i = 0; i < total_items; i++) {
+    if (built.Contain(i) != cuckoofilter::Ok) {
+      std::cout << "False negative seen at index " << i << " after merge" << std::endl;
+      return false;
+    }
+  }
+
+  if (built.Subtract(other) != cuckoofilter::Ok) {
+    std::cout << "failed to subtract the merged resizable filter\n";
+    return false;
+  }
+  for (size_t i = 0; i < total_items / 2; i++) {
+    if (built.Contain(i) != cuckoofilter::Ok) {
+      std::cout << "False negative seen at index " << i << " after subtract" << std::endl;
+      return false;
+    }
+  }
+  std::cout << "resizable filter of " << built.Size() << " entries merged and subtracted\n";
+  return true;
+}
+
+// Build a filter of the first half of the items and one of all of them,
+// with the same seed, on the given table; then apply the delta between them
+// to the first, and save the second compressed and load it back. Both must
+// still find every item.
+template <template <size_t> class TableType, size_t bits>
+bool run_round_trips(const char *table, size_t total_items, size_t fp_mult)
+{
+  typedef CuckooFilter<size_t, bits, TableType> Filter;
+  const std::string delta_file = "filter.delta";
+  const std::string compressed_file = "filter.compressed";
+
+  const uint64_t seed = 42;
+  Filter base(total_items, seed), full(total_items, seed);
+  for (size_t i = 0; i < total_items; i++) {
+    if ((i < total_items / 2 && base.Add(i) != cuckoofilter::Ok) ||
+        full.Add(i) != cuckoofilter::Ok) {
+      std::cout << "failed to insert item " << i << "\n";
+      return false;
+    }
+  }
+
+  if (!full.SaveDelta(base, delta_file) ||
+      base.ApplyDelta(delta_file) != cuckoofilter::Ok) {
+    std::cout << "failed to apply the delta to the " << table << " filter\n";
+    return false;
+  }
+  remove(delta_file.c_str());
+  if (base.Size() != full.Size() || !run_contains(&base, total_items, fp_mult)) {
+    std::cout << "the " << table << " filter differs after the delta\n";
+    return false;
+  }
+
+  if (!full.SaveCompressed(compressed_file)) {
+    std::cout << "failed to save the compressed " << table << " filter\n";
+    return false;
+  }
+  Filter loaded(compressed_file);
+  remove(compressed_file.c_str());
+  if (!loaded.Valid() || loaded.Size() != full.Size() ||
+      !run_contains(&loaded, total_items, fp_mult)) {
+    std::cout << "the compressed " << table << " filter did not load back\n";
+    return false;
+  }
+  std::cout << table << " filter of " << loaded.Size()
+            << " entries patched by delta and loaded compressed\n";
   return true;
 }
 
@@ -92,8 +262,7 @@ int main(int argc, const char **argv)
     }
   }
 
-  if (bits_per_item != 2 && bits_per_item != 4 && bits_per_item != 8 &&
-      bits_per_item != 12 && bits_per_item != 16 && bits_per_item != 32) {
+  if (bits_per_item < 2 || bits_per_item > 32) {
     usage();
   }
 
@@ -112,16 +281,10 @@ int main(int argc, const char **argv)
   /*
    * Run the normal test.
    */
-  BaseCuckooFilter<size_t> *filter;
-  switch(bits_per_item) {
-    case 2: filter = new CuckooFilter<size_t, 2>(total_items); break;
-    case 4: filter = new CuckooFilter<size_t, 4>(total_items); break;
-    case 8: filter = new CuckooFilter<size_t, 8>(total_items); break;
-    case 12: filter = new CuckooFilter<size_t, 12>(total_items); break;
-    case 16: filter = new CuckooFilter<size_t, 16>(total_items); break;
-    case 32: filter = new CuckooFilter<size_t, 32>(total_items); break;
-    default: filter = new CuckooFilter<size_t, 12>(total_items); break; // Eliminates compiler warning on Linux
-  }
+  FilterArgs args;
+  args.total_items = total_items;
+  args.filename = "filter.dat";
+  BaseCuckooFilter<size_t> *filter = new_filter<2>(bits_per_item, kNew, args);
   if (!filter->Valid()) {
     std::cout << "Failed to create cuckoo filter with <size_t, " << bits_per_item << "> and " << total_items << " items\n";
     return 1;
@@ -143,7 +306,7 @@ int main(int argc, const char **argv)
   }
 
   // Save the filter to disk for the next test
-  std::string filename = "filter.dat";
+  std::string filename = args.filename;
   filter->Save(filename);
 
   // Delete the filter to free up memory
@@ -153,14 +316,7 @@ int main(int argc, const char **argv)
    * Run the filename test.
    */
   // Create a new filter that will load in the saved filter
-  switch(bits_per_item) {
-    case 2: filter = new CuckooFilter<size_t, 2>(filename); break;
-    case 4: filter = new CuckooFilter<size_t, 4>(filename); break;
-    case 8: filter = new CuckooFilter<size_t, 8>(filename); break;
-    case 12: filter = new CuckooFilter<size_t, 12>(filename); break;
-    case 16: filter = new CuckooFilter<size_t, 16>(filename); break;
-    case 32: filter = new CuckooFilter<size_t, 32>(filename); break;
-  }
+  filter = new_filter<2>(bits_per_item, kFile, args);
   if (!filter->Valid()) {
     std::cout << "Failed to create cuckoo filter with <size_t, " << bits_per_item << "> and " << filename << " items\n";
     return 1;
@@ -208,14 +364,9 @@ int main(int argc, const char **argv)
   madvise(data, s.st_size, MADV_WILLNEED);
 
   // Create a new filter that will load in the memory mapped filter
-  switch(bits_per_item) {
-    case 2: filter = new CuckooFilter<size_t, 2>(data, s.st_size); break;
-    case 4: filter = new CuckooFilter<size_t, 4>(data, s.st_size); break;
-    case 8: filter = new CuckooFilter<size_t, 8>(data, s.st_size); break;
-    case 12: filter = new CuckooFilter<size_t, 12>(data, s.st_size); break;
-    case 16: filter = new CuckooFilter<size_t, 16>(data, s.st_size); break;
-    case 32: filter = new CuckooFilter<size_t, 32>(data, s.st_size); break;
-  }
+  args.data = data;
+  args.size = s.st_size;
+  filter = new_filter<2>(bits_per_item, kMemory, args);
   if (!filter->Valid()) {
     std::cout << "Failed to create cuckoo filter with <size_t, " << bits_per_item << "> and memory mapped " << filename << " items\n";
     return 1;
@@ -236,6 +387,39 @@ int main(int argc, const char **argv)
   // Close the open file
   close(fd);
 
+  /*
+   * Run the mmap test again, with the filter owning the mapping.
+   */
+  args.options.populate = true;
+  filter = new_filter<2>(bits_per_item, kMapped, args);
+  if (!filter->Valid()) {
+    std::cout << "Failed to map " << filename << " into a cuckoo filter with <size_t, " << bits_per_item << ">\n";
+    return 1;
+  }
+  if (!run_contains(filter, total_items, fp_mult)) {
+    std::cout << "Contain test failed\n";
+    return 1;
+  }
+  delete filter;
+
+  /*
+   * Run the resizable merge test.
+   */
+  if (!run_resizable(total_items)) {
+    std::cout << "Resizable test failed\n";
+    return 1;
+  }
+
+  /*
+   * Run the delta and compressed round trips on each table.
+   */
+  if (!run_round_trips<cuckoofilter::SingleTable, 12>("single", total_items, fp_mult) ||
+      !run_round_trips<cuckoofilter::PackedTable, 13>("packed", total_items, fp_mult) ||
+      !run_round_trips<cuckoofilter::BlockedTable, 12>("blocked", total_items, fp_mult)) {
+    std::cout << "Round trip test failed\n";
+    return 1;
+  }
+
   size_t num_buckets, num_items, data_size;
   if (!cuckoofilter::SavedInfo(filename, bits_per_item, num_buckets, num_items, data_size)) {
     std::cout << "Failed to get saved info for " << filename << std::endl;
@@ -245,6 +429,9 @@ int main(int argc, const char **argv)
     std::cout << "  Number of buckets: " << num_buckets << std::endl;
     std::cout << "  Number of items: " << num_items << std::endl;
     std::cout << "  Data size: " << data_size << std::endl;
+    std::cout << "  Checksum: "
+              << (cuckoofilter::VerifySaved(filename) ? "ok" : "mismatch")
+              << std::endl;
   }
 
   return 0;
@@ -1,22 +1,76 @@
 #ifndef CUCKOO_FILTER_BITS_H_
 #define CUCKOO_FILTER_BITS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
 namespace cuckoofilter {
 
-// inspired from
+// A uint64 with the low bit of each of n slots of bits bits set
+constexpr uint64_t SlotOnes(const size_t bits, const size_t n) {
+  return n == 0 ? 0 : (SlotOnes(bits, n - 1) << bits) | 1;
+}
+
+// The masks of the SWAR probe for tags of bits_per_tag bits: the low and the
+// high bit of each of the first kSlots tag slots of a bucket, as many as fit
+// whole in a uint64 read from its start.
+template <size_t bits_per_tag, size_t tags_per_bucket = 4>
+struct SlotMasks {
+  static const size_t kSlots = 64 / bits_per_tag < tags_per_bucket
+                                   ? 64 / bits_per_tag
+                                   : tags_per_bucket;
+  static const uint64_t kLow = SlotOnes(bits_per_tag, kSlots);
+  static const uint64_t kHigh = kLow << (bits_per_tag - 1);
+};
+
+// Does any of the slots SlotMasks covers in x hold tag. After x ^= the tag
+// in every slot, a matching slot is zero, and subtracting one from each slot
+// sets its high bit, see
 // http://www-graphics.stanford.edu/~seander/bithacks.html#ZeroInWord
-#define haszero4(x) (((x)-0x1111ULL) & (~(x)) & 0x8888ULL)
-#define hasvalue4(x, n) (haszero4((x) ^ (0x1111ULL * (n))))
+// A borrow only spreads upwards from a zero slot, so the test is exact as to
+// whether any slot matches; bits above the last slot are ignored.
+template <size_t bits_per_tag, size_t tags_per_bucket = 4>
+inline bool HasValue(uint64_t x, const uint32_t tag) {
+  typedef SlotMasks<bits_per_tag, tags_per_bucket> Masks;
+  x ^= Masks::kLow * tag;
+  return ((x - Masks::kLow) & ~x & Masks::kHigh) != 0;
+}
+
+// Tags of bits_per_tag bits packed least significant bit first, slot j at
+// bit j * bits_per_tag of its bucket. A slot is read and written with one
+// unaligned uint64 at a byte offset known at compile time once the loop
+// over j is unrolled, so there is no branch on the width or the slot. The
+// word starts no later than span - 8 bytes into the bucket, so only
+// [p, p + span) is touched; span must be at least 8 and the bucket size.
+template <size_t bits_per_tag, size_t span>
+struct PackedSlots {
+  static const uint64_t kTagMask = (1ULL << bits_per_tag) - 1;
 
-#define haszero8(x) (((x)-0x01010101ULL) & (~(x)) & 0x80808080ULL)
-#define hasvalue8(x, n) (haszero8((x) ^ (0x01010101ULL * (n))))
+  // the byte the word of slot j starts at, and the bit the slot starts at in
+  // it; a slot starts at most 7 bits into its byte, and one moved back to
+  // span - 8 still ends by bit 64, since the bucket does
+  static constexpr size_t Byte(const size_t j) {
+    return j * bits_per_tag / 8 < span - 8 ? j * bits_per_tag / 8 : span - 8;
+  }
+  static constexpr size_t Shift(const size_t j) {
+    return j * bits_per_tag - 8 * Byte(j);
+  }
 
-#define haszero12(x) (((x)-0x001001001001ULL) & (~(x)) & 0x800800800800ULL)
-#define hasvalue12(x, n) (haszero12((x) ^ (0x001001001001ULL * (n))))
+  static inline uint32_t Read(const char *p, const size_t j) {
+    uint64_t v;
+    memcpy(&v, p + Byte(j), sizeof(v));
+    return (v >> Shift(j)) & kTagMask;
+  }
 
-#define haszero16(x) \
-  (((x)-0x0001000100010001ULL) & (~(x)) & 0x8000800080008000ULL)
-#define hasvalue16(x, n) (haszero16((x) ^ (0x0001000100010001ULL * (n))))
+  static inline void Write(char *p, const size_t j, const uint32_t tag) {
+    uint64_t v;
+    memcpy(&v, p + Byte(j), sizeof(v));
+    v = (v & ~(kTagMask << Shift(j))) | ((uint64_t)tag << Shift(j));
+    memcpy(p + Byte(j), &v, sizeof(v));
+  }
+};
 
 inline uint64_t upperpower2(uint64_t x) {
   x--;
@@ -30,6 +84,92 @@ inline uint64_t upperpower2(uint64_t x) {
   return x;
 }
 
+// largest power of two that is no greater than x (x > 0)
+inline uint64_t lowerpower2(uint64_t x) {
+  uint64_t p = upperpower2(x);
+  return p == x ? x : p >> 1;
+}
+
+// Writes values of up to 32 bits to p, least significant bit first, 32
+// bits at a time; Flush writes out the last partial word. Exactly as many
+// bytes as the bits put need are written.
+class BitWriter {
+ public:
+  explicit BitWriter(unsigned char *p) : p_(p), acc_(0), num_bits_(0) {}
+
+  inline void Put(const uint32_t v, const size_t bits) {
+    acc_ |= (uint64_t)v << num_bits_;
+    num_bits_ += bits;
+    if (num_bits_ >= 32) {
+      const uint32_t word = (uint32_t)acc_;
+      memcpy(p_, &word, sizeof(word));
+      p_ += sizeof(word);
+      acc_ >>= 32;
+      num_bits_ -= 32;
+    }
+  }
+
+  inline void Flush() {
+    const uint32_t word = (uint32_t)acc_;
+    memcpy(p_, &word, (num_bits_ + 7) / 8);
+    p_ += (num_bits_ + 7) / 8;
+    acc_ = 0;
+    num_bits_ = 0;
+  }
+
+ private:
+  unsigned char *p_;
+  uint64_t acc_;
+  size_t num_bits_;
+};
+
+// Reads back what a BitWriter wrote to [p, end). Reading past end returns
+// zero bits and sets Overrun().
+class BitReader {
+ public:
+  BitReader(const unsigned char *p, const unsigned char *end)
+      : p_(p), end_(end), acc_(0), num_bits_(0), overrun_(false) {}
+
+  inline uint32_t Get(const size_t bits) {
+    if (num_bits_ < bits) {
+      Refill(bits);
+    }
+    const uint32_t v = (uint32_t)(acc_ & ((1ULL << bits) - 1));
+    acc_ >>= bits;
+    num_bits_ -= bits;
+    return v;
+  }
+
+  bool Overrun() const { return overrun_; }
+
+ private:
+  // Top acc_ up to 56 bits or more, a word at a time away from the end,
+  // and to bits bits near it
+  inline void Refill(const size_t bits) {
+    if (end_ - p_ >= 8) {
+      uint64_t word;
+      memcpy(&word, p_, sizeof(word));
+      acc_ |= word << num_bits_;
+      p_ += (63 - num_bits_) / 8;
+      num_bits_ |= 56;
+      return;
+    }
+    for (; num_bits_ < bits; num_bits_ += 8) {
+      if (p_ < end_) {
+        acc_ |= (uint64_t)*p_++ << num_bits_;
+      } else {
+        overrun_ = true;
+      }
+    }
+  }
+
+  const unsigned char *p_;
+  const unsigned char *end_;
+  uint64_t acc_;
+  size_t num_bits_;
+  bool overrun_;
+};
+
 }  // namespace cuckoofilter
 
 #endif  // CUCKOO_FILTER_BITS_H
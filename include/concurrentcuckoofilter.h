@@ -0,0 +1,275 @@
+#ifndef CUCKOO_FILTER_CONCURRENT_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_CONCURRENT_CUCKOO_FILTER_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "cuckoofilter.h"
+
+namespace cuckoofilter {
+
+// A cuckoo filter that may be read by any number of threads while others
+// update it. Writers (Add, Delete, Save) are serialized by a mutex. Readers
+// (Contain, ContainBatch) never lock and never write shared memory.
+//
+// Buckets are covered by striped version counters, as in libcuckoo's
+// optimistic locking. A writer makes the version of a stripe odd while it
+// changes a bucket in it and even again once done. A reader that finds its
+// tag returns at once. A reader that does not find it checks that neither
+// version moved during the probe, and probes again if one did. Insertion
+// first searches a cuckoo path without touching the table, the way the
+// insert strategy says, then applies it from the free slot backwards,
+// copying each tag before overwriting its slot. A tag is therefore always in
+// one of its buckets, and no kick chain can make a reader miss it. The
+// stash, which only Delete changes here, has a version counter of its own.
+//
+// The CuckooFilter is a protected base, so that Merge, Subtract, BulkBuild,
+// ApplyDelta and the other methods that write the table without the lock or
+// the versions cannot be called on it.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class ConcurrentCuckooFilter
+    : protected CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> {
+  typedef CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> Filter;
+  typedef typename Filter::PathStep PathStep;
+
+  // number of version counters buckets are striped over
+  static const size_t kNumStripes = 1 << 12;
+
+  std::unique_ptr<std::atomic<uint32_t>[]> versions_;
+
+  // version of the stash
+  std::atomic<uint32_t> stash_version_;
+
+  void InitStripes() {
+    versions_.reset(new std::atomic<uint32_t>[kNumStripes]);
+    for (size_t s = 0; s < kNumStripes; s++) {
+      versions_[s].store(0, std::memory_order_relaxed);
+    }
+    stash_version_.store(0, std::memory_order_relaxed);
+  }
+
+  inline std::atomic<uint32_t> &Stripe(const size_t i) const {
+    return versions_[i & (kNumStripes - 1)];
+  }
+
+  // Bracket a change to what version v covers, a stripe of buckets or the
+  // stash; only called with write_mutex_ held
+  static inline void BeginWrite(std::atomic<uint32_t> &v) {
+    v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  static inline void EndWrite(std::atomic<uint32_t> &v) {
+    v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Probe buckets i1 and i2 for tag, again if a writer changed either of
+  // them during the probe and the tag was not found
+  inline bool FindTag(const size_t i1, const size_t i2,
+                      const uint32_t tag) const {
+    const std::atomic<uint32_t> &v1 = Stripe(i1);
+    const std::atomic<uint32_t> &v2 = Stripe(i2);
+    for (;;) {
+      uint32_t s1 = v1.load(std::memory_order_acquire);
+      uint32_t s2 = v2.load(std::memory_order_acquire);
+      if (this->table_->FindTagInBuckets(i1, i2, tag)) {
+        return true;
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (((s1 | s2) & 1) == 0 &&
+          v1.load(std::memory_order_relaxed) == s1 &&
+          v2.load(std::memory_order_relaxed) == s2) {
+        return false;
+      }
+    }
+  }
+
+  // Look for tag of the item with buckets i1 and i2 in the stash, again if
+  // a writer changed it during the search
+  inline bool FindStashed(const size_t i1, const size_t i2,
+                          const uint32_t tag) const {
+    for (;;) {
+      uint32_t s = stash_version_.load(std::memory_order_acquire);
+      bool found = (s & 1) == 0 && this->stash_size_ != 0 &&
+                   this->StashContains(i1, i2, tag);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if ((s & 1) == 0 && stash_version_.load(std::memory_order_relaxed) == s) {
+        return found;
+      }
+    }
+  }
+
+  inline bool DeleteTag(const size_t i, const uint32_t tag) {
+    BeginWrite(Stripe(i));
+    bool ok = this->table_->DeleteTagFromBucket(i, tag);
+    EndWrite(Stripe(i));
+    return ok;
+  }
+
+  // Filter::ApplyPath with every write bracketed. Each tag is copied to its
+  // next bucket before its slot is overwritten.
+  void ApplyPath(const PathStep *path, const size_t len, const uint32_t tag) {
+    uint32_t oldtag;
+    BeginWrite(Stripe(path[len - 1].index));
+    this->table_->InsertTagToBucket(path[len - 1].index,
+                                    len > 1 ? path[len - 2].tag : tag, false,
+                                    oldtag);
+    EndWrite(Stripe(path[len - 1].index));
+    for (size_t j = len - 1; j > 0; j--) {
+      const PathStep &step = path[j - 1];
+      BeginWrite(Stripe(step.index));
+      this->table_->WriteTag(step.index, step.slot,
+                             j > 1 ? path[j - 2].tag : tag);
+      EndWrite(Stripe(step.index));
+    }
+  }
+
+ protected:
+  // serializes writers
+  mutable std::mutex write_mutex_;
+
+  // Add tag to bucket i1 or i2, or to a bucket a cuckoo path from them
+  // frees; write_mutex_ must be held
+  Status AddTagLocked(const size_t i1, const size_t i2, const uint32_t tag) {
+    PathStep path[kMaxCuckooCount + 1];
+    size_t len = this->FindPath(i1, i2, path);
+    if (len == 0) {
+      return NotEnoughSpace;
+    }
+    ApplyPath(path, len, tag);
+    this->num_items_++;
+    return Ok;
+  }
+
+  // Delete tag from bucket i1 or i2 or the stash; write_mutex_ must be held
+  Status DeleteTagLocked(const size_t i1, const size_t i2,
+                         const uint32_t tag) {
+    if (DeleteTag(i1, tag) || DeleteTag(i2, tag)) {
+      this->num_items_--;
+      return Ok;
+    }
+    if (this->stash_size_ != 0) {
+      BeginWrite(stash_version_);
+      bool ok = this->StashRemove(i1, i2, tag);
+      EndWrite(stash_version_);
+      if (ok) {
+        this->num_items_--;
+        return Ok;
+      }
+    }
+    return NotFound;
+  }
+
+ public:
+  explicit ConcurrentCuckooFilter(const size_t max_num_keys)
+      : Filter(max_num_keys) {
+    InitStripes();
+  }
+
+  explicit ConcurrentCuckooFilter(void *addr, size_t length)
+      : Filter(addr, length) {
+    InitStripes();
+  }
+
+  explicit ConcurrentCuckooFilter(const std::string &path) : Filter(path) {
+    InitStripes();
+  }
+
+  // Add an item to the filter. Unlike CuckooFilter::Add a full filter is
+  // reported before anything is moved, so nothing is ever evicted.
+  Status Add(const ItemType &item) {
+    size_t i1, i2;
+    uint32_t tag;
+    this->GenerateIndexTagHash(item, &i1, &tag);
+    i2 = this->AltIndex(i1, tag);
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return AddTagLocked(i1, i2, tag);
+  }
+
+  // Report if the item is inserted, with false positive rate. Safe to call
+  // concurrently with writers.
+  Status Contain(const ItemType &key) const {
+    size_t i1, i2;
+    uint32_t tag;
+    this->GenerateIndexTagHash(key, &i1, &tag);
+    i2 = this->AltIndex(i1, tag);
+
+    // Only a filter loaded from a save of a CuckooFilter has stashed tags,
+    // and only Delete ever removes them
+    if (FindStashed(i1, i2, tag) || FindTag(i1, i2, tag)) {
+      return Ok;
+    }
+    return NotFound;
+  }
+
+  // Report for each of the n keys if it is inserted. Safe to call
+  // concurrently with writers.
+  void ContainBatch(const ItemType *keys, size_t n, uint8_t *results) const {
+    size_t i1[kContainBatchSize], i2[kContainBatchSize];
+    uint32_t tag[kContainBatchSize];
+
+    for (size_t base = 0; base < n; base += kContainBatchSize) {
+      const size_t count = std::min(kContainBatchSize, n - base);
+      for (size_t k = 0; k < count; k++) {
+        this->GenerateIndexTagHash(keys[base + k], &i1[k], &tag[k]);
+        i2[k] = this->AltIndex(i1[k], tag[k]);
+        this->table_->PrefetchBucket(i1[k]);
+        this->table_->PrefetchBucket(i2[k]);
+      }
+
+      // A hit of the unvalidated batched probe is real; a miss may have
+      // raced with a writer, so it is confirmed while its buckets are still
+      // cached
+      uint8_t found[kContainBatchSize];
+      this->table_->FindTagInBucketsBatch(i1, i2, tag, count, found);
+      for (size_t k = 0; k < count; k++) {
+        bool hit = found[k] || FindStashed(i1[k], i2[k], tag[k]) ||
+                   FindTag(i1[k], i2[k], tag[k]);
+        results[base + k] = hit ? Ok : NotFound;
+      }
+    }
+  }
+
+  // Delete an key from the filter
+  Status Delete(const ItemType &key) {
+    size_t i1, i2;
+    uint32_t tag;
+    this->GenerateIndexTagHash(key, &i1, &tag);
+    i2 = this->AltIndex(i1, tag);
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return DeleteTagLocked(i1, i2, tag);
+  }
+
+  // number of current inserted items;
+  size_t Size() const {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return this->num_items_;
+  }
+
+  // save the filter to a file, as of a point between two updates
+  bool Save(const std::string path) const {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return Filter::Save(path);
+  }
+
+  // Choose how Add makes room in a full pair of buckets, see
+  // CuckooFilter::SetInsertStrategy
+  void SetInsertStrategy(const InsertStrategy strategy) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Filter::SetInsertStrategy(strategy);
+  }
+
+  using Filter::Info;
+  using Filter::SizeInBytes;
+  using Filter::LoadFactor;
+  using Filter::SavedSize;
+  using Filter::Valid;
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_CONCURRENT_CUCKOO_FILTER_H_
@@ -0,0 +1,402 @@
+#ifndef CUCKOO_FILTER_COUNTING_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_COUNTING_CUCKOO_FILTER_H_
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "cuckoofilter.h"
+
+namespace cuckoofilter {
+
+// The header CountingCuckooFilter::Save writes ahead of its counters, which
+// are num_counters_ CountingRecords checksummed by counters_crc_; what
+// CuckooFilter writes for the table follows them. Fixed width, little
+// endian.
+const char kCountingFormatMagic[8] = {'C', 'U', 'C', 'K', 'O', 'O', 'C', 'T'};
+const uint32_t kCountingFormatVersion = 1;
+
+struct CountingHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t bits_per_item_;
+  uint64_t num_counters_;
+  uint32_t counters_crc_;
+  uint32_t header_crc_;
+};
+
+struct CountingRecord {
+  uint64_t key;
+  uint64_t count;
+};
+
+// A cuckoo filter that counts the items added more than once instead of
+// storing their tag again. Add first looks for the item's tag in its two
+// buckets; if it is there, Add only increments a counter for it, so a hot
+// item takes one slot however often it is added. Delete decrements the
+// counter and removes the tag once it drops to zero.
+//
+// Most items are added once, so the counters live in an overflow table that
+// only holds items with duplicates, keyed by the item's bucket pair and tag.
+// It is a flat, linear probed array of (key, count) pairs, so looking up a
+// counter costs a cache miss or two rather than the node chasing of a
+// std::unordered_map.
+// Like a tag, a count can belong to several items that share their buckets
+// and tag; Count then reports their total.
+//
+// The compressed and delta saves only know about the table, so they are not
+// available here, and ApplyDelta and Subtract return NotSupported.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class CountingCuckooFilter
+    : public CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> {
+  typedef CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> Filter;
+
+  // An open addressed map of counter keys to counts, with linear probing.
+  // Keys are never 0, as tags are not, so a 0 key marks an empty slot. It is
+  // kept at most half full.
+  class CounterTable {
+    std::vector<CountingRecord> slots_;
+    size_t size_;
+    // 64 less the log2 of the number of slots
+    size_t shift_;
+
+    inline size_t Home(const uint64_t key) const {
+      return (key * 0x9e3779b97f4a7c15ULL) >> shift_;
+    }
+
+    // The slot holding key, or the empty slot it would go in
+    inline size_t Find(const uint64_t key) const {
+      const size_t mask = slots_.size() - 1;
+      size_t s = Home(key);
+      while (slots_[s].key != 0 && slots_[s].key != key) {
+        s = (s + 1) & mask;
+      }
+      return s;
+    }
+
+    void Grow() {
+      std::vector<CountingRecord> old;
+      old.swap(slots_);
+      slots_.assign(old.empty() ? 16 : 2 * old.size(), CountingRecord());
+      shift_ = 64 - __builtin_ctzll(slots_.size());
+      for (const CountingRecord &record : old) {
+        if (record.key != 0) {
+          slots_[Find(record.key)] = record;
+        }
+      }
+    }
+
+    // Empty slot s, moving back the keys after it that probed past it
+    void Erase(size_t s) {
+      const size_t mask = slots_.size() - 1;
+      for (size_t t = (s + 1) & mask; slots_[t].key != 0; t = (t + 1) & mask) {
+        if (((t - Home(slots_[t].key)) & mask) >= ((t - s) & mask)) {
+          slots_[s] = slots_[t];
+          s = t;
+        }
+      }
+      slots_[s] = CountingRecord();
+      size_--;
+    }
+
+   public:
+    CounterTable() : size_(0), shift_(64) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // count of key, 0 if it has none
+    uint64_t Get(const uint64_t key) const {
+      return size_ == 0 ? 0 : slots_[Find(key)].count;
+    }
+
+    // add n to the count of key
+    void Add(const uint64_t key, const uint64_t n) {
+      if (2 * (size_ + 1) > slots_.size()) {
+        Grow();
+      }
+      CountingRecord &record = slots_[Find(key)];
+      if (record.key == 0) {
+        record.key = key;
+        size_++;
+      }
+      record.count += n;
+    }
+
+    // take one off the count of key, dropping it at 0; returns false if key
+    // has no count
+    bool Decrement(const uint64_t key) {
+      if (size_ == 0) {
+        return false;
+      }
+      const size_t s = Find(key);
+      if (slots_[s].key == 0) {
+        return false;
+      }
+      if (--slots_[s].count == 0) {
+        Erase(s);
+      }
+      return true;
+    }
+
+    // call fn(record) for every key with a count
+    template <typename Fn>
+    void ForEach(const Fn &fn) const {
+      for (const CountingRecord &record : slots_) {
+        if (record.key != 0) {
+          fn(record);
+        }
+      }
+    }
+  };
+
+  // Number of times each item with duplicates was added beyond the first
+  CounterTable counters_;
+
+  // Total of counters_
+  size_t num_duplicates_;
+
+  // Names an item by its tag and the lower of its two buckets, which do not
+  // change when the tag is kicked. Bucket indexes come from 32 bits of the
+  // hash, so both fit.
+  inline uint64_t CounterKey(const size_t i1, const size_t i2,
+                             const uint32_t tag) const {
+    return ((uint64_t)std::min(i1, i2) << 32) | tag;
+  }
+
+  inline bool Stored(const size_t i1, const size_t i2,
+                     const uint32_t tag) const {
+    return this->table_->FindTagInBuckets(i1, i2, tag) ||
+           (this->stash_size_ != 0 && this->StashContains(i1, i2, tag));
+  }
+
+  // Load the counters saved at addr; returns the bytes they take, or 0 if
+  // they are not there or fail their checksums
+  size_t LoadCounters(const char *addr, size_t length) {
+    if (length < sizeof(CountingHeader)) {
+      return 0;
+    }
+    CountingHeader sh;
+    memcpy(&sh, addr, sizeof(sh));
+    if (memcmp(sh.magic_, kCountingFormatMagic,
+               sizeof(kCountingFormatMagic)) != 0 ||
+        sh.version_ != kCountingFormatVersion ||
+        sh.header_crc_ !=
+            Crc32c(0, &sh, offsetof(CountingHeader, header_crc_)) ||
+        sh.bits_per_item_ != bits_per_item ||
+        sh.num_counters_ >
+            (length - sizeof(CountingHeader)) / sizeof(CountingRecord)) {
+      return 0;
+    }
+    const char *records = addr + sizeof(CountingHeader);
+    const size_t records_size = sh.num_counters_ * sizeof(CountingRecord);
+    if (Crc32c(0, records, records_size) != sh.counters_crc_) {
+      return 0;
+    }
+    for (uint64_t c = 0; c < sh.num_counters_; c++) {
+      CountingRecord record;
+      memcpy(&record, records + c * sizeof(record), sizeof(record));
+      if (record.key == 0 || record.count == 0) {
+        counters_ = CounterTable();
+        num_duplicates_ = 0;
+        return 0;
+      }
+      counters_.Add(record.key, record.count);
+      num_duplicates_ += record.count;
+    }
+    return sizeof(CountingHeader) + records_size;
+  }
+
+  // Add tag of the item whose first bucket is i1, or count it again if it
+  // is already in one of its buckets
+  Status AddTag(const size_t i1, const uint32_t tag) {
+    const size_t i2 = this->AltIndex(i1, tag);
+    if (Stored(i1, i2, tag)) {
+      counters_.Add(CounterKey(i1, i2, tag), 1);
+      num_duplicates_++;
+      return Ok;
+    }
+    if (this->stash_size_ == kStashSize) {
+      return NotEnoughSpace;
+    }
+    return this->AddImpl(i1, tag);
+  }
+
+ public:
+  explicit CountingCuckooFilter(const size_t max_num_keys)
+      : Filter(max_num_keys), num_duplicates_(0) {}
+
+  // A filter whose hash functions are derived from seed; filters built with
+  // the same seed and size can be merged
+  CountingCuckooFilter(const size_t max_num_keys, const uint64_t seed)
+      : Filter(max_num_keys, seed), num_duplicates_(0) {}
+
+  explicit CountingCuckooFilter(void *addr, size_t length)
+      : num_duplicates_(0) {
+    // Load the filter from the specified buffer. We will not own the data we
+    // read in, so the caller better not free it...
+    size_t offset = LoadCounters(static_cast<char *>(addr), length);
+    if (offset > 0) {
+      this->Load(static_cast<char *>(addr) + offset, length - offset);
+    }
+  }
+
+  explicit CountingCuckooFilter(const std::string &path)
+      : num_duplicates_(0) {
+    // Read the saved filter from the specified path. We will own the data we
+    // read in and free it in the destructor.
+    size_t size = this->ReadFile(path);
+    size_t offset = LoadCounters(this->readbuf_, size);
+    if (offset > 0) {
+      this->Load(this->readbuf_ + offset, size - offset);
+    }
+  }
+
+  // Add an item to the filter, or count it again if its tag is already in
+  // one of its buckets
+  Status Add(const ItemType &item) {
+    size_t i;
+    uint32_t tag;
+    this->GenerateIndexTagHash(item, &i, &tag);
+    return AddTag(i, tag);
+  }
+
+  // Add the n keys one at a time, on this thread whatever num_threads is,
+  // so that keys added more than once are counted. Returns NotEnoughSpace if
+  // the filter filled up, with only some keys added.
+  Status BulkBuild(const ItemType *keys, const size_t n,
+                   const size_t num_threads = 1) {
+    for (size_t k = 0; k < n; k++) {
+      const Status status = Add(keys[k]);
+      if (status != Ok) {
+        return status;
+      }
+    }
+    return Ok;
+  }
+
+  // Add every item of other, a filter of the same size built with the same
+  // seed, on this thread; a tag of other that is already here is counted as
+  // Add would, and if other is a CountingCuckooFilter its counts are added
+  // too. Returns NotSupported if the filters do not hash alike, and
+  // NotEnoughSpace if this filter filled up, with only some of the items of
+  // other added.
+  Status Merge(const Filter &other, const size_t num_threads = 1) {
+    if (!this->HashesLike(other)) {
+      return NotSupported;
+    }
+    Status status = Ok;
+    Filter::ForEachTag(other, [&](size_t i, uint32_t tag) {
+      if (status == Ok) {
+        status = AddTag(i, tag);
+      }
+    });
+    if (status != Ok) {
+      return status;
+    }
+    const CountingCuckooFilter *counting =
+        dynamic_cast<const CountingCuckooFilter *>(&other);
+    if (counting) {
+      counting->counters_.ForEach([&](const CountingRecord &record) {
+        counters_.Add(record.key, record.count);
+        num_duplicates_ += record.count;
+      });
+    }
+    return Ok;
+  }
+
+  // Subtract and ApplyDelta do not know about the counters; they change
+  // nothing and return NotSupported
+  Status Subtract(const Filter &, const size_t = 1) { return NotSupported; }
+  Status ApplyDelta(const void *, const size_t) { return NotSupported; }
+
+  bool SaveCompressed(const std::string path,
+                      const size_t num_threads = 1) const = delete;
+  void SaveCompressedTo(std::ostream &os,
+                        const size_t num_threads = 1) const = delete;
+  bool SaveDelta(const Filter &base, const std::string path) const = delete;
+  void SaveDeltaTo(const Filter &base, std::ostream &os) const = delete;
+  Status ApplyDelta(const std::string &path) = delete;
+
+  // Delete one count of an item from the filter
+  Status Delete(const ItemType &item) {
+    size_t i1, i2;
+    uint32_t tag;
+    this->GenerateIndexTagHash(item, &i1, &tag);
+    i2 = this->AltIndex(i1, tag);
+
+    if (counters_.Decrement(CounterKey(i1, i2, tag))) {
+      num_duplicates_--;
+      return Ok;
+    }
+    return Filter::Delete(item);
+  }
+
+  // Number of times the item was added and not deleted, with the false
+  // positive rate of Contain
+  size_t Count(const ItemType &item) const {
+    size_t i1, i2;
+    uint32_t tag;
+    this->GenerateIndexTagHash(item, &i1, &tag);
+    i2 = this->AltIndex(i1, tag);
+
+    if (!Stored(i1, i2, tag)) {
+      return 0;
+    }
+    return 1 + counters_.Get(CounterKey(i1, i2, tag));
+  }
+
+  // number of Adds counted instead of stored, less the Deletes of them
+  size_t NumDuplicates() const { return num_duplicates_; }
+
+  /* methods for providing stats  */
+  // summary infomation
+  std::string Info() const {
+    std::stringstream ss;
+    ss << Filter::Info() << "\t\tKeys with duplicates: " << counters_.size()
+       << "\n\t\tDuplicates counted: " << num_duplicates_ << "\n";
+    return ss.str();
+  }
+
+  // number of bytes Save writes
+  size_t SavedSize() const {
+    return sizeof(CountingHeader) + counters_.size() * sizeof(CountingRecord) +
+           Filter::SavedSize();
+  }
+
+  // save the filter, counters included, to a file
+  bool Save(const std::string path) const {
+    std::ofstream wf(path, std::ios::out | std::ios::binary);
+    if (!wf) {
+      return false;
+    }
+    SaveTo(wf);
+    wf.close();
+    return wf.good();
+  }
+
+  // write the filter to a stream, in the format Save writes to a file; the
+  // caller checks the stream for errors
+  void SaveTo(std::ostream &os) const {
+    CountingHeader sh;
+    memset(&sh, 0, sizeof(sh));
+    memcpy(sh.magic_, kCountingFormatMagic, sizeof(sh.magic_));
+    sh.version_ = kCountingFormatVersion;
+    sh.bits_per_item_ = bits_per_item;
+    sh.num_counters_ = counters_.size();
+    counters_.ForEach([&](const CountingRecord &record) {
+      sh.counters_crc_ = Crc32c(sh.counters_crc_, &record, sizeof(record));
+    });
+    sh.header_crc_ = Crc32c(0, &sh, offsetof(CountingHeader, header_crc_));
+    os.write(reinterpret_cast<const char *>(&sh), sizeof(sh));
+    counters_.ForEach([&](const CountingRecord &record) {
+      os.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    });
+    Filter::SaveTo(os);
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_COUNTING_CUCKOO_FILTER_H_
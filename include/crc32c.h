@@ -0,0 +1,156 @@
+#ifndef CUCKOO_FILTER_CRC32C_H_
+#define CUCKOO_FILTER_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CUCKOO_FILTER_X86_CRC32 1
+#include <immintrin.h>
+#endif
+
+namespace cuckoofilter {
+
+// CRC32C (Castagnoli), the checksum of saved filters. It continues from crc,
+// so data can be checksummed a piece at a time as it streams by:
+//
+//   Crc32c(Crc32c(0, a, n), b, m) == Crc32c(0, a followed by b, n + m)
+//
+// and Crc32cCombine joins the checksums of pieces computed apart, so a large
+// buffer can be checksummed on several threads.
+//
+// Cpus with SSE4.2 compute it with the crc32 instruction at several GB/s;
+// others use a table driven fallback that handles 8 bytes per step.
+
+namespace crc32c_internal {
+
+// The tables of the fallback: table[0] for one byte, table[k] for a byte
+// followed by k zero bytes
+struct Tables {
+  uint32_t table[8][256];
+
+  Tables() {
+    for (uint32_t b = 0; b < 256; b++) {
+      uint32_t crc = b;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+      }
+      table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+      for (int k = 1; k < 8; k++) {
+        table[k][b] =
+            (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+      }
+    }
+  }
+};
+
+inline uint32_t ExtendPortable(uint32_t crc, const uint8_t *p, size_t len) {
+  static const Tables tables;
+  const uint32_t(*t)[256] = tables.table;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    v ^= crc;
+    crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+          t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^
+          t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+  }
+  for (; len > 0; p++, len--) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+  }
+  return crc;
+}
+
+#ifdef CUCKOO_FILTER_X86_CRC32
+__attribute__((target("sse4.2"))) inline uint32_t ExtendSSE42(
+    uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t crc64 = crc;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    crc64 = _mm_crc32_u64(crc64, v);
+  }
+  crc = (uint32_t)crc64;
+  for (; len > 0; p++, len--) {
+    crc = _mm_crc32_u8(crc, *p);
+  }
+  return crc;
+}
+#endif
+
+// The product of the 32x32 matrix over GF(2) whose columns are mat and the
+// vector vec
+inline uint32_t Gf2Times(const uint32_t *mat, uint32_t vec) {
+  uint32_t sum = 0;
+  for (; vec; vec >>= 1, mat++) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+  }
+  return sum;
+}
+
+inline void Gf2Square(uint32_t *square, const uint32_t *mat) {
+  for (int n = 0; n < 32; n++) {
+    square[n] = Gf2Times(mat, mat[n]);
+  }
+}
+
+}  // namespace crc32c_internal
+
+inline uint32_t Crc32c(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+#ifdef CUCKOO_FILTER_X86_CRC32
+  static const bool sse42 = __builtin_cpu_supports("sse4.2");
+  if (sse42) {
+    return ~crc32c_internal::ExtendSSE42(~crc, p, len);
+  }
+#endif
+  return ~crc32c_internal::ExtendPortable(~crc, p, len);
+}
+
+// The checksum of a followed by b, from crc_a = Crc32c(0, a, ...) and
+// crc_b = Crc32c(0, b, len_b), in O(log len_b) steps (the method of zlib's
+// crc32_combine)
+inline uint32_t Crc32cCombine(uint32_t crc_a, const uint32_t crc_b,
+                              size_t len_b) {
+  using crc32c_internal::Gf2Square;
+  using crc32c_internal::Gf2Times;
+  if (len_b == 0) {
+    return crc_a;
+  }
+  // odd starts as the operator appending one zero bit; squared twice it
+  // appends four, so the first square in the loop appends one zero byte
+  uint32_t even[32], odd[32];
+  odd[0] = 0x82f63b78;
+  for (int n = 1; n < 32; n++) {
+    odd[n] = 1U << (n - 1);
+  }
+  Gf2Square(even, odd);
+  Gf2Square(odd, even);
+
+  // Append len_b zero bytes to crc_a, squaring the operator for each bit
+  // of len_b
+  do {
+    Gf2Square(even, odd);
+    if (len_b & 1) {
+      crc_a = Gf2Times(even, crc_a);
+    }
+    len_b >>= 1;
+    if (len_b == 0) {
+      break;
+    }
+    Gf2Square(odd, even);
+    if (len_b & 1) {
+      crc_a = Gf2Times(odd, crc_a);
+    }
+    len_b >>= 1;
+  } while (len_b != 0);
+  return crc_a ^ crc_b;
+}
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_CRC32C_H_
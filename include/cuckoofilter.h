@@ -2,10 +2,17 @@
 #define CUCKOO_FILTER_CUCKOO_FILTER_H_
 
 #include <assert.h>
+#include <stddef.h>
 #include <algorithm>
 #include <fstream>
+#include <vector>
+#include "blockedtable.h"
+#include "crc32c.h"
+#include "packedtable.h"
 #include "singletable.h"
+#include "threadutil.h"
 #include "twoindependentmultiplyshift.h"
+#include "wyhash.h"
 
 namespace cuckoofilter {
 // status returned by a cuckoo filter operation
@@ -16,9 +23,127 @@ enum Status {
   NotSupported = 3,
 };
 
+// seed of the generator of the slots kicked by a filter built without one
+const uint64_t kRandomSeed = 0x9e3779b97f4a7c15ULL;
+
 // maximum number of cuckoo kicks before claiming failure
 const size_t kMaxCuckooCount = 500;
 
+// number of tags a filter keeps aside when a cuckoo kick chain fails; once
+// they are all taken Add reports NotEnoughSpace
+const size_t kStashSize = 4;
+
+// number of keys ContainBatch hashes and prefetches before probing any of them
+const size_t kContainBatchSize = 16;
+
+// maximum number of tags a breadth-first insertion moves
+const size_t kMaxBFSDepth = 4;
+
+// number of buckets Merge and BulkBuild hand to a thread at a time
+const size_t kBucketChunkSize = 1 << 14;
+
+// number of buckets Merge and Subtract check for being empty at once
+const size_t kEmptyRunBuckets = 64;
+
+// How Add makes room for an item whose two buckets are full
+enum InsertStrategy {
+  // kick a random tag to its other bucket, up to kMaxCuckooCount times
+  kRandomWalk = 0,
+  // search the shortest path to a free slot, up to kMaxBFSDepth moves away,
+  // and fall back to a random walk if there is none
+  kBreadthFirst = 1,
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the tables and the saved filter format are little endian"
+#endif
+
+// The format Save writes: a SavedHeader, then the data_size_ bytes of the
+// table. Every field is fixed width and little endian, and the header is a
+// multiple of 64 bytes long, so the table of a filter mapped from a file is
+// cache line aligned. data_crc_ is the CRC32C of the table and header_crc_
+// that of the header bytes before it. A filter is only loaded if its magic,
+// version, checksums and template parameters all match.
+//
+// A filter modified in place through a writable mapping keeps its header up
+// to date but sets kTableCrcStale in flags_ until the table checksum is
+// computed again; only the header of such a file can be checked.
+//
+// SaveCompressed sets kCompressed in flags_, and writes a compressed table
+// instead of the table, in chunks of kBucketChunkSize buckets that load on
+// several threads: one uint64_t per chunk with the offset where it ends,
+// counted from the end of these offsets, then the chunks. A chunk is one
+// byte, kChunkPlain or kChunkMasked, then the tags of its buckets, slot by
+// slot, bits_per_item bits each, least significant bit first. A masked
+// chunk starts with one bit per slot, set if it holds a tag, padded to a
+// byte, and leaves out the empty slots. data_size_ and data_crc_ are those
+// of the compressed table.
+//
+// SaveDelta sets kDelta in flags_, and writes the header of the new filter
+// followed by what changed in its table since the base filter instead of
+// the table: a uint64_t count of DeltaRanges, the ranges, and the new bytes
+// of each range, in order. A range is a run of whole 8 byte words of the
+// table, with the CRC32C of its bytes in the base and in the new filter, so
+// that ApplyDelta only patches the table the delta was computed against.
+// data_size_ and data_crc_ are those of everything after the header.
+const char kFormatMagic[8] = {'C', 'U', 'C', 'K', 'O', 'O', 'F', 'L'};
+const uint32_t kFormatVersion = 1;
+
+const uint32_t kTableCrcStale = 1;
+const uint32_t kCompressed = 2;
+const uint32_t kDelta = 4;
+
+const unsigned char kChunkPlain = 0;
+const unsigned char kChunkMasked = 1;
+
+struct SavedVictim {
+  uint64_t index;
+  uint32_t tag;
+  uint32_t reserved;
+};
+
+struct SavedHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t bits_per_item_;
+  uint32_t table_id_;  // TableType<bits_per_item>::kFormatId
+  uint32_t hash_id_;   // HashFamily::kFormatId
+  uint64_t num_buckets_;
+  uint64_t num_items_;
+  uint64_t data_size_;
+  uint32_t data_crc_;
+  uint32_t stash_size_;
+  SavedVictim stash_[kStashSize];
+  unsigned char hash_data_[64];
+  uint32_t flags_;
+  uint32_t header_crc_;
+};
+
+static_assert(sizeof(SavedHeader) % 64 == 0,
+              "SavedHeader must keep the table cache line aligned");
+
+struct DeltaRange {
+  uint64_t offset_;
+  uint64_t length_;
+  uint32_t old_crc_;
+  uint32_t new_crc_;
+};
+
+// granularity of the ranges of a delta, in bytes
+const size_t kDeltaWordSize = 8;
+
+inline uint32_t HeaderCrc(const SavedHeader &sh) {
+  return Crc32c(0, &sh, offsetof(SavedHeader, header_crc_));
+}
+
+// Is sh the header of a filter saved in this format, whatever its template
+// parameters
+inline bool ValidHeader(const SavedHeader &sh) {
+  return memcmp(sh.magic_, kFormatMagic, sizeof(kFormatMagic)) == 0 &&
+         sh.version_ == kFormatVersion && sh.header_crc_ == HeaderCrc(sh) &&
+         sh.stash_size_ <= kStashSize;
+}
+
 // Base cuckoo filter class
 template <typename ItemType>
 class BaseCuckooFilter
@@ -33,6 +158,11 @@ class BaseCuckooFilter
   // Report if the item is inserted, with false positive rate.
   virtual Status Contain(const ItemType &item) const = 0;
 
+  // Report for each of the n keys if it is inserted. results[i] is set to the
+  // Status Contain(keys[i]) would return.
+  virtual void ContainBatch(const ItemType *keys, size_t n,
+                            uint8_t *results) const = 0;
+
   // Delete an key from the filter
   virtual Status Delete(const ItemType &item) = 0;
 
@@ -58,12 +188,26 @@ class BaseCuckooFilter
 // template parameters:
 //   ItemType:  the type of item you want to insert
 //   bits_per_item: how many bits each item is hashed into
-//   TableType: the storage of table, SingleTable by default, and
-// PackedTable to enable semi-sorting
+//   TableType: the storage of table, SingleTable by default, BlockedTable to
+// keep every bucket inside one cache line, and PackedTable to enable
+// semi-sorting; Associativity<2>::SingleTable and
+// Associativity<8>::SingleTable for buckets of 2 or 8 tags instead of 4
+//   HashFamily: the hash of items, TwoIndependentMultiplyShift for integers
+// by default, and WyHash for strings
+// A TableType and a HashFamily name themselves in saved filters with a
+// static kFormatId.
+//
+// A filter built with a seed hashes items and picks the tags it kicks the
+// same way as any other filter built with that seed, so building it again
+// from the same keys gives the same bytes, and filters of the same size and
+// seed can be merged.
 template <typename ItemType, size_t bits_per_item,
           template <size_t> class TableType = SingleTable,
           typename HashFamily = TwoIndependentMultiplyShift>
 class CuckooFilter : public BaseCuckooFilter<ItemType> {
+ protected:
+  static const size_t kTagsPerBucket = TableType<bits_per_item>::kTagsPerBucket;
+
   // Storage of items
   TableType<bits_per_item> *table_;
 
@@ -76,17 +220,11 @@ class CuckooFilter : public BaseCuckooFilter<ItemType> {
     bool used;
   } VictimCache;
 
-  // The header we will use when we save the filter
-  typedef struct {
-    size_t bits_per_item_;
-    size_t num_buckets_;
-    size_t num_items_;
-    uint64_t data_size_;
-    unsigned char hash_data_[512];
-    VictimCache victim_;
-  } SaveHeader;
-
-  VictimCache victim_;
+  // Tags whose kick chain failed, in the first stash_size_ entries. A tag in
+  // the stash is in the filter like any other, and moves back into the table
+  // once a Delete makes room for it.
+  VictimCache stash_[kStashSize];
+  size_t stash_size_;
 
   HashFamily hasher_;
 
@@ -122,23 +260,115 @@ class CuckooFilter : public BaseCuckooFilter<ItemType> {
     return IndexHash((uint32_t)(index ^ (tag * 0x5bd1e995)));
   }
 
+  InsertStrategy strategy_;
+
+  // State of the generator of the slots kicked, seeded with the hasher so
+  // that a seeded build is reproducible
+  mutable uint64_t random_;
+
+  // xorshift64*
+  inline uint32_t NextRandom() const {
+    random_ ^= random_ >> 12;
+    random_ ^= random_ << 25;
+    random_ ^= random_ >> 27;
+    return (uint32_t)((random_ * 0x2545f4914f6cdd1dULL) >> 32);
+  }
+
+  // Store tag in a random slot of the full bucket i, and return the tag
+  // it kicks out
+  inline uint32_t KickTag(const size_t i, const uint32_t tag) {
+    const size_t r = NextRandom() % kTagsPerBucket;
+    const uint32_t oldtag = table_->ReadTag(i, r);
+    table_->WriteTag(i, r, tag);
+    return oldtag;
+  }
+
   Status AddImpl(const size_t i, const uint32_t tag);
 
-  // load factor is the fraction of occupancy
-  double LoadFactor() const { return 1.0 * Size() / table_->SizeInTags(); }
+  // One step of a cuckoo path: the tag in slot of bucket index moves into
+  // the bucket of the next step. The last step has no tag; its bucket has a
+  // free slot.
+  struct PathStep {
+    size_t index;
+    size_t slot;
+    uint32_t tag;
+  };
+
+  // Find a path that frees a slot in bucket i1 or i2 without modifying the
+  // table, the way strategy_ says. Returns the number of steps written to
+  // path (room for kMaxCuckooCount + 1), or 0 if there is none. A path never
+  // visits a bucket twice, so applying it back to front, each tag copied to
+  // its next bucket before its slot is reused, keeps every tag in one of its
+  // two buckets at all times.
+  size_t FindPath(const size_t i1, const size_t i2, PathStep *path) const;
+
+  // FindPath by a random walk of at most kMaxCuckooCount kicks
+  size_t FindPathRandomWalk(const size_t i1, const size_t i2,
+                            PathStep *path) const;
+
+  // FindPath by a breadth-first search of the buckets at most kMaxBFSDepth
+  // moves away; the path found is a shortest one
+  size_t FindPathBFS(const size_t i1, const size_t i2, PathStep *path) const;
+
+  // Move the tags of a path found by FindPath and store tag in the slot
+  // freed in its first bucket, one write per step
+  void ApplyPath(const PathStep *path, const size_t len, const uint32_t tag);
+
+  // Is tag of the item with buckets i1 and i2 in the stash
+  inline bool StashContains(const size_t i1, const size_t i2,
+                            const uint32_t tag) const {
+    bool found = false;
+    for (size_t s = 0; s < stash_size_; s++) {
+      found |= (tag == stash_[s].tag) &&
+               (i1 == stash_[s].index || i2 == stash_[s].index);
+    }
+    return found;
+  }
+
+  // Remove one copy of tag of the item with buckets i1 and i2 from the stash
+  bool StashRemove(const size_t i1, const size_t i2, const uint32_t tag) {
+    for (size_t s = 0; s < stash_size_; s++) {
+      if (tag == stash_[s].tag &&
+          (i1 == stash_[s].index || i2 == stash_[s].index)) {
+        stash_[s] = stash_[--stash_size_];
+        stash_[stash_size_].used = false;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Move a stashed tag back into the table, if a path to a free slot for
+  // one of them can be found now
+  void Unstash();
 
   double BitsPerItem() const { return 8.0 * table_->SizeInBytes() / Size(); }
 
- public:
-  explicit CuckooFilter(const size_t max_num_keys) : table_(nullptr), num_items_(0), victim_(), hasher_(), readbuf_(nullptr) {
-    // Build the filter fased on the max number of keys and the bit size.
-    size_t assoc = 4;
+  // The load factor a table of buckets of kTagsPerBucket tags reliably
+  // fills to before an insert fails: about 84%, 96% and 98% for 2, 4 and 8
+  // tags per bucket
+  static constexpr double MaxLoadFactor() {
+    return kTagsPerBucket <= 2 ? 0.84 : kTagsPerBucket <= 4 ? 0.96 : 0.98;
+  }
+
+  // Number of buckets fewer than depth moves away from the two buckets of
+  // an item, counted once per path to them: 2 * (1 + b + ... + b^(depth-1))
+  // for b = kTagsPerBucket
+  static constexpr size_t BFSNodes(const size_t depth) {
+    return depth == 0 ? 0 : 2 + kTagsPerBucket * BFSNodes(depth - 1);
+  }
+
+  // Build the table for max_num_keys keys
+  void Create(const size_t max_num_keys) {
+    // Build the filter fased on the max number of keys and the bit size,
+    // with twice the buckets if max_num_keys would fill them past
+    // MaxLoadFactor().
+    const size_t assoc = kTagsPerBucket;
     size_t num_buckets = upperpower2(std::max<uint64_t>(1, max_num_keys / assoc));
     double frac = (double)max_num_keys / num_buckets / assoc;
-    if (frac > 0.96) {
+    if (frac > MaxLoadFactor()) {
       num_buckets <<= 1;
     }
-    victim_.used = false;
     try {
       table_ = new(std::nothrow) TableType<bits_per_item>(num_buckets);
     } catch (std::bad_alloc& ba) {
@@ -146,54 +376,241 @@ class CuckooFilter : public BaseCuckooFilter<ItemType> {
     }
   }
 
-  explicit CuckooFilter(void *addr, size_t length) : table_(nullptr), num_items_(0), victim_(), hasher_(), readbuf_(nullptr) {
-    // Load the filter from the specified buffer. We will not own the data we
-    // read in, so the caller better not free it...
-    SaveHeader *sh = reinterpret_cast<SaveHeader *>(addr);
-    num_items_ = sh->num_items_;
-    victim_ = sh->victim_;
-    hasher_.load(sh->hash_data_, sizeof(sh->hash_data_));
-    char *data = (char *)addr + sizeof(SaveHeader);
-    length = length - sizeof(SaveHeader);
-    try {
-      table_ = new TableType<bits_per_item>(data, length);
-    } catch (std::bad_alloc& ba) {
-      // Caller should call Valid() to ensure filter is built
+  // Copy the tags of buckets [begin, end) of other into the same buckets
+  // here. Tags that do not fit are appended to overflow, to be added with
+  // kicks. Returns the number of tags copied.
+  size_t MergeBuckets(const CuckooFilter &other, const size_t begin,
+                      const size_t end, std::vector<VictimCache> *overflow);
+
+  // Delete the tags of buckets [begin, end) of other from the same buckets
+  // here. Tags not found there are appended to missing, to be looked for
+  // in their other bucket and the stash. Returns the number deleted.
+  size_t SubtractBuckets(const CuckooFilter &other, const size_t begin,
+                         const size_t end, std::vector<VictimCache> *missing);
+
+  // A tag to be stored in bucket index by BulkBuild. Bucket indexes come
+  // from 32 bits of the hash, so they fit.
+  struct BulkEntry {
+    uint32_t index;
+    uint32_t tag;
+  };
+
+  // Set entries to the n entries get(k) returns, grouped by the chunk of
+  // kBucketChunkSize buckets they go to and otherwise in order of k; the
+  // entries of chunk c start at (*chunk_begin)[c]. get is called twice
+  // for each k, from num_threads threads.
+  template <typename Get>
+  void PartitionEntries(const size_t n, size_t num_threads, const Get &get, std::vector<BulkEntry> *entries,
+                        std::vector<size_t> *chunk_begin) const;
+
+  // Store the tag of each of the entries in its bucket, on num_threads
+  // threads, one chunk at a time. Those that do not fit are appended to
+  // overflow with their other bucket.
+  void FillChunks(const std::vector<BulkEntry> &entries,
+                  const std::vector<size_t> &chunk_begin,
+                  const size_t num_threads, std::vector<BulkEntry> *overflow);
+
+  // Append the chunk of buckets [begin, end) in the compressed format to out
+  void EncodeChunk(const size_t begin, const size_t end,
+                   std::vector<unsigned char> *out) const;
+
+  // Write the tags of the chunk of buckets [begin, end) at p back to the
+  // slots they were saved from, so the table is the one saved, byte for
+  // byte; a table without stable slots, which keeps its buckets sorted, gets
+  // the same bytes by inserting them. Returns false if the chunk is
+  // malformed.
+  bool DecodeChunk(const size_t begin, const size_t end,
+                   const unsigned char *p, const size_t len);
+
+  // Build the table from the compressed table at data, decoding it on
+  // num_threads threads, and check it against sh unless verify_checksum is
+  // false. Returns false, with no table, if it cannot.
+  bool LoadCompressed(const SavedHeader &sh, const unsigned char *data,
+                      const bool verify_checksum, const size_t num_threads);
+
+  // An empty filter, for a derived class that saves more than the filter to
+  // load from its own format
+  CuckooFilter() : table_(nullptr), num_items_(0), stash_(), stash_size_(0), hasher_(), readbuf_(nullptr), strategy_(kRandomWalk), random_(kRandomSeed) {}
+
+  // Load the filter Save wrote to the buffer at addr, if it was saved by a
+  // filter of this type and, unless verify_checksum is false, its table is
+  // intact; otherwise no table is loaded. We will not own the data, so the
+  // caller better not free it... A filter SaveCompressed wrote is decoded
+  // into a table of our own, on num_threads threads.
+  void Load(void *addr, size_t length, const bool verify_checksum = true,
+            const size_t num_threads = 1) {
+    SavedHeader sh;
+    if (length < sizeof(sh)) {
+      return;
+    }
+    memcpy(&sh, addr, sizeof(sh));
+    if (!ValidHeader(sh) || sh.bits_per_item_ != bits_per_item ||
+        sh.table_id_ != TableType<bits_per_item>::kFormatId ||
+        sh.hash_id_ != HashFamily::kFormatId ||
+        sh.data_size_ > length - sizeof(sh) || (sh.flags_ & kDelta)) {
+      return;
+    }
+    for (size_t s = 0; s < sh.stash_size_; s++) {
+      if (sh.stash_[s].index >= sh.num_buckets_) {
+        return;
+      }
+    }
+    char *data = (char *)addr + sizeof(sh);
+    if (verify_checksum && !(sh.flags_ & (kTableCrcStale | kCompressed)) &&
+        Crc32c(0, data, sh.data_size_) != sh.data_crc_) {
+      return;
+    }
+    if (!hasher_.load(sh.hash_data_, sizeof(sh.hash_data_))) {
+      return;
     }
+    if (sh.flags_ & kCompressed) {
+      if (!LoadCompressed(sh, (const unsigned char *)data, verify_checksum,
+                          num_threads)) {
+        return;
+      }
+    } else {
+      try {
+        table_ = new TableType<bits_per_item>(data, sh.data_size_);
+      } catch (std::bad_alloc& ba) {
+        // Caller should call Valid() to ensure filter is built
+        return;
+      }
+    }
+    if (table_->NumBuckets() != sh.num_buckets_) {
+      delete table_;
+      table_ = nullptr;
+      return;
+    }
+    num_items_ = sh.num_items_;
+    for (size_t s = 0; s < sh.stash_size_; s++) {
+      stash_[s].index = sh.stash_[s].index;
+      stash_[s].tag = sh.stash_[s].tag;
+      stash_[s].used = true;
+    }
+    stash_size_ = sh.stash_size_;
   }
 
-  explicit CuckooFilter(const std::string &path) : table_(nullptr), num_items_(0), victim_(), hasher_(), readbuf_(nullptr) {
-    // Read the saved filter from the specified path. We will own the data we
-    // read in and free it in the destructor.
+  // Build the header Save writes in front of the table. The table checksum
+  // is computed unless flags has kTableCrcStale, kCompressed or kDelta.
+  void BuildHeader(SavedHeader *sh, const uint32_t flags) const {
+    memset(sh, 0, sizeof(*sh));
+    memcpy(sh->magic_, kFormatMagic, sizeof(sh->magic_));
+    sh->version_ = kFormatVersion;
+    sh->bits_per_item_ = bits_per_item;
+    sh->table_id_ = TableType<bits_per_item>::kFormatId;
+    sh->hash_id_ = HashFamily::kFormatId;
+    sh->num_buckets_ = table_->NumBuckets();
+    sh->num_items_ = num_items_;
+    sh->data_size_ = table_->SizeInBytes();
+    if (!(flags & (kTableCrcStale | kCompressed | kDelta))) {
+      sh->data_crc_ = Crc32c(0, table_->Data(), table_->SizeInBytes());
+    }
+    sh->stash_size_ = stash_size_;
+    for (size_t s = 0; s < stash_size_; s++) {
+      sh->stash_[s].index = stash_[s].index;
+      sh->stash_[s].tag = stash_[s].tag;
+    }
+    hasher_.save(sh->hash_data_, sizeof(sh->hash_data_));
+    sh->flags_ = flags;
+    sh->header_crc_ = HeaderCrc(*sh);
+  }
+
+  // Call fn(i, tag) for every tag of f, in its table and its stash, with i
+  // the bucket it is stored in
+  template <typename Fn>
+  static void ForEachTag(const CuckooFilter &f, const Fn &fn) {
+    for (size_t i = 0; i < f.table_->NumBuckets(); i++) {
+      for (size_t j = 0; j < kTagsPerBucket; j++) {
+        const uint32_t tag = f.table_->ReadTag(i, j);
+        if (tag != 0) {
+          fn(i, tag);
+        }
+      }
+    }
+    for (size_t s = 0; s < f.stash_size_; s++) {
+      fn(f.stash_[s].index, f.stash_[s].tag);
+    }
+  }
+
+  // Does other have a table of the same size and the same hash functions
+  bool HashesLike(const CuckooFilter &other) const {
+    unsigned char hash_data[512], other_hash_data[512];
+    memset(hash_data, 0, sizeof(hash_data));
+    memset(other_hash_data, 0, sizeof(other_hash_data));
+    hasher_.save(hash_data, sizeof(hash_data));
+    other.hasher_.save(other_hash_data, sizeof(other_hash_data));
+    return table_->NumBuckets() == other.table_->NumBuckets() &&
+           memcmp(hash_data, other_hash_data, sizeof(hash_data)) == 0;
+  }
+
+  // Read the whole file at path into buf. Returns false if it cannot.
+  static bool ReadWholeFile(const std::string &path, std::vector<char> *buf) {
     std::ifstream rf(path, std::ios::in | std::ios::binary | std::ios::ate);
     if (!rf) {
-      return;
+      return false;
+    }
+    buf->resize(rf.tellg());
+    rf.seekg(0);
+    return (bool)rf.read(buf->data(), buf->size());
+  }
+
+  // Read the file at path into readbuf_, which we will free in the
+  // destructor. Returns its size, or 0 if it cannot be read.
+  size_t ReadFile(const std::string &path) {
+    std::ifstream rf(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!rf) {
+      return 0;
     }
     size_t size = rf.tellg();
     readbuf_ = new char[size];
     if (!readbuf_) {
-      return;
+      return 0;
     }
     rf.seekg(0);
     if (!rf.read(readbuf_, size)) {
-      return;
+      return 0;
     }
     rf.close();
+    return size;
+  }
 
-    SaveHeader *sh = reinterpret_cast<SaveHeader *>(readbuf_);
-    num_items_ = sh->num_items_;
-    victim_ = sh->victim_;
-    hasher_.load(sh->hash_data_, sizeof(sh->hash_data_));
-    char *data = readbuf_ + sizeof(SaveHeader);
-    size_t length = size - sizeof(SaveHeader);
-    try {
-      table_ = new TableType<bits_per_item>(data, length);
-    } catch (std::bad_alloc& ba) {
-      // Caller should call Valid() to ensure filter is built
+ public:
+  explicit CuckooFilter(const size_t max_num_keys) : table_(nullptr), num_items_(0), stash_(), stash_size_(0), hasher_(), readbuf_(nullptr), strategy_(kRandomWalk), random_(kRandomSeed) {
+    Create(max_num_keys);
+  }
+
+  // Build a filter whose hash functions are derived from seed; HashFamily
+  // must be constructible from a uint64_t
+  CuckooFilter(const size_t max_num_keys, const uint64_t seed) : table_(nullptr), num_items_(0), stash_(), stash_size_(0), hasher_(seed), readbuf_(nullptr), strategy_(kRandomWalk), random_(seed | 1) {
+    Create(max_num_keys);
+  }
+
+  // The loading constructors check the saved filter and load nothing if it
+  // is not one of this type or, unless verify_checksum is false, its table
+  // does not match its checksum. Caller should call Valid(). A compressed
+  // filter is decoded on num_threads threads.
+  explicit CuckooFilter(void *addr, size_t length, const bool verify_checksum = true, const size_t num_threads = 1) : table_(nullptr), num_items_(0), stash_(), stash_size_(0), hasher_(), readbuf_(nullptr), strategy_(kRandomWalk), random_(kRandomSeed) {
+    // Load the filter from the specified buffer. We will not own the data we
+    // read in, so the caller better not free it...
+    Load(addr, length, verify_checksum, num_threads);
+  }
+
+  explicit CuckooFilter(const std::string &path, const bool verify_checksum = true, const size_t num_threads = 1) : table_(nullptr), num_items_(0), stash_(), stash_size_(0), hasher_(), readbuf_(nullptr), strategy_(kRandomWalk), random_(kRandomSeed) {
+    // Read the saved filter from the specified path. We will own the data we
+    // read in and free it in the destructor.
+    size_t size = ReadFile(path);
+    if (size == 0) {
+      return;
+    }
+    Load(readbuf_, size, verify_checksum, num_threads);
+    if (Valid() && (((SavedHeader *)readbuf_)->flags_ & kCompressed)) {
+      // The table is decoded into memory of its own
+      delete[] readbuf_;
+      readbuf_ = nullptr;
     }
   }
 
-  ~CuckooFilter() { delete table_; delete readbuf_; }
+  ~CuckooFilter() { delete table_; delete[] readbuf_; }
 
   // Add an item to the filter.
   Status Add(const ItemType &item);
@@ -201,9 +618,47 @@ class CuckooFilter : public BaseCuckooFilter<ItemType> {
   // Report if the item is inserted, with false positive rate.
   Status Contain(const ItemType &item) const;
 
+  // Report for each of the n keys if it is inserted. The keys are hashed and
+  // both of their buckets prefetched in groups, so the cache misses of a group
+  // overlap instead of being paid one after another.
+  void ContainBatch(const ItemType *keys, size_t n, uint8_t *results) const;
+
   // Delete an key from the filter
   Status Delete(const ItemType &item);
 
+  // Add every tag of other, a filter of the same size built with the same
+  // seed, so that this filter then holds the items of both. Each tag goes to
+  // the bucket it has in other; only those that do not fit are kicked in.
+  // The buckets are copied on num_threads threads. Returns NotSupported if
+  // the filters do not hash alike, and NotEnoughSpace if this filter filled
+  // up, with only some of the tags of other added.
+  //
+  // Merge, Subtract, BulkBuild and ApplyDelta are virtual, like Add and
+  // Delete, so that a derived filter that guards its table, such as a read
+  // only MappedCuckooFilter, does so however it is reached.
+  virtual Status Merge(const CuckooFilter &other,
+                       const size_t num_threads = 1);
+
+  // Delete every item of other, a filter of the same size built with the
+  // same seed, from this filter, as if each were passed to Delete; like
+  // Delete, that is only right for items that were added to this filter.
+  // Each tag is deleted from the bucket it has in other, on num_threads
+  // threads, and the few that are not there from their other bucket or
+  // the stash. Returns NotSupported if the filters do not hash alike, and
+  // NotFound if some tags of other were not in this filter.
+  virtual Status Subtract(const CuckooFilter &other,
+                          const size_t num_threads = 1);
+
+  // Add the n keys at keys on num_threads threads, with one pass over the
+  // table instead of a random access per key. The keys are hashed and
+  // grouped by the chunk of buckets their first bucket is in, and each
+  // thread fills whole chunks; the tags that find both their buckets full
+  // are then added with kicks, on this thread. The result does not depend on
+  // num_threads. Needs 8 bytes of memory per key while building. Returns
+  // NotEnoughSpace if the filter filled up, with only some keys added.
+  virtual Status BulkBuild(const ItemType *keys, const size_t n,
+                           const size_t num_threads = 1);
+
   /* methods for providing stats  */
   // summary infomation
   std::string Info() const;
@@ -214,41 +669,110 @@ class CuckooFilter : public BaseCuckooFilter<ItemType> {
   // size of the filter in bytes.
   size_t SizeInBytes() const { return table_->SizeInBytes(); }
 
+  // load factor is the fraction of occupancy
+  double LoadFactor() const { return 1.0 * Size() / table_->SizeInTags(); }
+
+  // number of bytes Save writes
+  size_t SavedSize() const { return sizeof(SavedHeader) + SizeInBytes(); }
+
   // save the filter to a file
   bool Save(const std::string path) const {
-    // Build the header
-    SaveHeader sh;
-    memset(&sh, 0, sizeof(sh));
-    sh.bits_per_item_ = bits_per_item;
-    sh.num_buckets_ = table_->NumBuckets();
-    sh.num_items_ = Size();
-    sh.data_size_ = table_->SizeInBytes();
-    sh.victim_.index = victim_.index;
-    sh.victim_.tag = victim_.tag;
-    sh.victim_.used = victim_.used;
-    hasher_.save(sh.hash_data_, sizeof(sh.hash_data_));
+    std::ofstream wf(path, std::ios::out | std::ios::binary);
+    if(!wf) {
+      return false;
+    }
+    SaveTo(wf);
+    wf.close();
+    return wf.good();
+  }
+
+  // write the filter to a stream, in the format Save writes to a file; the
+  // caller checks the stream for errors
+  void SaveTo(std::ostream &os) const {
+    SavedHeader sh;
+    BuildHeader(&sh, 0);
 
     const unsigned char *data = table_->Data();
     size_t length = table_->SizeInBytes();
 
+    os.write(reinterpret_cast<const char*>(&sh), sizeof(sh));
+    os.write(reinterpret_cast<const char*>(data), length);
+  }
+
+  // save the filter to a file in the compressed format, which is smaller
+  // the emptier the table is: an empty slot takes one bit instead of
+  // bits_per_item, in the chunks where that pays. The chunks are encoded on
+  // num_threads threads. Loading it decodes a copy of the table, so it
+  // cannot be mapped.
+  bool SaveCompressed(const std::string path,
+                      const size_t num_threads = 1) const {
     std::ofstream wf(path, std::ios::out | std::ios::binary);
-    if(!wf) {
+    if (!wf) {
       return false;
     }
-    wf.write(reinterpret_cast<const char*>(&sh), sizeof(sh));
-    wf.write(reinterpret_cast<const char*>(data), length);
+    SaveCompressedTo(wf, num_threads);
     wf.close();
-    if(!wf.good()) {
+    return wf.good();
+  }
+
+  // write the filter to a stream, in the format SaveCompressed writes to a
+  // file; the caller checks the stream for errors
+  void SaveCompressedTo(std::ostream &os, const size_t num_threads = 1) const;
+
+  // save to a file the changes that turn base, a filter of the same size
+  // built with the same seed, into this filter: the runs of table words that
+  // differ, and the new item count and stash. Its size is about that of the
+  // runs. Returns false if the filters do not hash alike or the file cannot
+  // be written.
+  bool SaveDelta(const CuckooFilter &base, const std::string path) const {
+    if (!HashesLike(base)) {
+      return false;
+    }
+    std::ofstream wf(path, std::ios::out | std::ios::binary);
+    if (!wf) {
       return false;
     }
+    SaveDeltaTo(base, wf);
+    wf.close();
+    return wf.good();
+  }
 
-    return true;
+  // write the delta from base to this filter to a stream, in the format
+  // SaveDelta writes to a file; the caller checks that the filters hash
+  // alike, and the stream for errors
+  void SaveDeltaTo(const CuckooFilter &base, std::ostream &os) const;
+
+  // Patch this filter in place with the delta SaveDelta wrote to the buffer
+  // at addr, turning it into the filter the delta was saved from. Nothing
+  // is changed, and NotSupported returned, unless the delta is intact, was
+  // saved against a filter that hashes like this one, and every range it
+  // patches holds the bytes it had in that filter. Not safe while other
+  // threads read the filter.
+  virtual Status ApplyDelta(const void *addr, const size_t length);
+
+  // ApplyDelta with the delta saved at path
+  Status ApplyDelta(const std::string &path) {
+    std::vector<char> buf;
+    if (!ReadWholeFile(path, &buf)) {
+      return NotSupported;
+    }
+    return ApplyDelta(buf.data(), buf.size());
   }
 
   bool Valid() const {
     // Valid means we have a table loaded
     return table_ != nullptr;
   }
+
+  // Choose how Add makes room in a full pair of buckets. kBreadthFirst
+  // moves fewer tags per insert and has a much shorter latency tail near
+  // full load; kRandomWalk, the default, does less work per insert at low
+  // load.
+  void SetInsertStrategy(const InsertStrategy strategy) {
+    strategy_ = strategy;
+  }
+
+  InsertStrategy GetInsertStrategy() const { return strategy_; }
 };
 
 template <typename ItemType, size_t bits_per_item,
@@ -258,7 +782,7 @@ Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Add(
   size_t i;
   uint32_t tag;
 
-  if (victim_.used) {
+  if (stash_size_ == kStashSize) {
     return NotEnoughSpace;
   }
 
@@ -270,26 +794,179 @@ template <typename ItemType, size_t bits_per_item,
           template <size_t> class TableType, typename HashFamily>
 Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::AddImpl(
     const size_t i, const uint32_t tag) {
+  if (strategy_ == kBreadthFirst) {
+    PathStep path[kMaxBFSDepth + 1];
+    size_t len = FindPathBFS(i, AltIndex(i, tag), path);
+    if (len > 0) {
+      ApplyPath(path, len, tag);
+      num_items_++;
+      return Ok;
+    }
+  }
+
   size_t curindex = i;
   uint32_t curtag = tag;
   uint32_t oldtag;
 
   for (uint32_t count = 0; count < kMaxCuckooCount; count++) {
-    bool kickout = count > 0;
-    oldtag = 0;
-    if (table_->InsertTagToBucket(curindex, curtag, kickout, oldtag)) {
+    if (table_->InsertTagToBucket(curindex, curtag, false, oldtag)) {
       num_items_++;
       return Ok;
     }
-    if (kickout) {
-      curtag = oldtag;
+    if (count > 0) {
+      curtag = KickTag(curindex, curtag);
     }
     curindex = AltIndex(curindex, curtag);
   }
 
+  // The kick chain failed and curtag has no slot; keep it in the stash, for
+  // which Add left room
+  stash_[stash_size_].index = curindex;
+  stash_[stash_size_].tag = curtag;
+  stash_[stash_size_].used = true;
+  stash_size_++;
+  num_items_++;
   return Ok;
 }
 
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+size_t CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::FindPath(
+    const size_t i1, const size_t i2, PathStep *path) const {
+  if (strategy_ == kBreadthFirst) {
+    size_t len = FindPathBFS(i1, i2, path);
+    if (len > 0) {
+      return len;
+    }
+  }
+  return FindPathRandomWalk(i1, i2, path);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+size_t CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::
+    FindPathRandomWalk(const size_t i1, const size_t i2,
+                       PathStep *path) const {
+  if (table_->NumTagsInBucket(i1) < kTagsPerBucket) {
+    path[0].index = i1;
+    return 1;
+  }
+  if (table_->NumTagsInBucket(i2) < kTagsPerBucket) {
+    path[0].index = i2;
+    return 1;
+  }
+
+  size_t curindex = (NextRandom() & 1) ? i1 : i2;
+  for (size_t count = 0; count < kMaxCuckooCount; count++) {
+    path[count].index = curindex;
+    if (count > 0 && table_->NumTagsInBucket(curindex) < kTagsPerBucket) {
+      return count + 1;
+    }
+
+    // Kick a random tag whose other bucket is not on the path yet
+    size_t r = NextRandom() % kTagsPerBucket;
+    size_t next = curindex;
+    for (size_t j = 0; j < kTagsPerBucket && next == curindex; j++) {
+      size_t slot = (r + j) % kTagsPerBucket;
+      uint32_t victim = table_->ReadTag(curindex, slot);
+      size_t alt = AltIndex(curindex, victim);
+      bool visited = false;
+      for (size_t k = 0; k <= count && !visited; k++) {
+        visited = path[k].index == alt;
+      }
+      if (!visited) {
+        path[count].slot = slot;
+        path[count].tag = victim;
+        next = alt;
+      }
+    }
+    if (next == curindex) {
+      return 0;
+    }
+    curindex = next;
+  }
+  return 0;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+size_t CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::
+    FindPathBFS(const size_t i1, const size_t i2, PathStep *path) const {
+  if (table_->NumTagsInBucket(i1) < kTagsPerBucket) {
+    path[0].index = i1;
+    return 1;
+  }
+  if (table_->NumTagsInBucket(i2) < kTagsPerBucket) {
+    path[0].index = i2;
+    return 1;
+  }
+
+  // A node is a full bucket, reached from the bucket of node parent by
+  // moving the tag in slot of that bucket. Only nodes fewer than
+  // kMaxBFSDepth moves away are queued, as only those are expanded.
+  struct Node {
+    size_t index;
+    size_t slot;
+    int parent;
+    size_t depth;
+  };
+  static const size_t kMaxNodes = BFSNodes(kMaxBFSDepth);
+  Node queue[kMaxNodes];
+  size_t head = 0, tail = 0;
+  queue[tail++] = Node{i1, 0, -1, 0};
+  queue[tail++] = Node{i2, 0, -1, 0};
+
+  while (head < tail) {
+    const Node &node = queue[head];
+    for (size_t slot = 0; slot < kTagsPerBucket; slot++) {
+      size_t alt = AltIndex(node.index, table_->ReadTag(node.index, slot));
+      // skip buckets already on the path to this node
+      bool visited = false;
+      for (int n = head; n >= 0 && !visited; n = queue[n].parent) {
+        visited = queue[n].index == alt;
+      }
+      if (visited) {
+        continue;
+      }
+      if (table_->NumTagsInBucket(alt) < kTagsPerBucket) {
+        // Found a free slot; walk back to the root to write the path
+        size_t len = node.depth + 2;
+        path[len - 1].index = alt;
+        size_t s = slot;
+        for (int n = head, k = len - 2; n >= 0; n = queue[n].parent, k--) {
+          path[k].index = queue[n].index;
+          path[k].slot = s;
+          path[k].tag = table_->ReadTag(queue[n].index, s);
+          s = queue[n].slot;
+        }
+        return len;
+      }
+      if (node.depth + 1 < kMaxBFSDepth && tail < kMaxNodes) {
+        queue[tail++] = Node{alt, slot, (int)head, node.depth + 1};
+      }
+    }
+    head++;
+  }
+  return 0;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::ApplyPath(
+    const PathStep *path, const size_t len, const uint32_t tag) {
+  uint32_t oldtag;
+  if (len == 1) {
+    table_->InsertTagToBucket(path[0].index, tag, false, oldtag);
+    return;
+  }
+  table_->InsertTagToBucket(path[len - 1].index, path[len - 2].tag, false,
+                            oldtag);
+  for (size_t j = len - 2; j > 0; j--) {
+    table_->WriteTag(path[j].index, path[j].slot, path[j - 1].tag);
+  }
+  table_->WriteTag(path[0].index, path[0].slot, tag);
+}
+
 template <typename ItemType, size_t bits_per_item,
           template <size_t> class TableType, typename HashFamily>
 Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Contain(
@@ -303,8 +980,7 @@ Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Contain(
 
   assert(i1 == AltIndex(i2, tag));
 
-  found = victim_.used && (tag == victim_.tag) &&
-          (i1 == victim_.index || i2 == victim_.index);
+  found = stash_size_ != 0 && StashContains(i1, i2, tag);
 
   if (found || table_->FindTagInBuckets(i1, i2, tag)) {
     return Ok;
@@ -313,6 +989,37 @@ Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Contain(
   }
 }
 
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::ContainBatch(
+    const ItemType *keys, const size_t n, uint8_t *results) const {
+  size_t i1[kContainBatchSize], i2[kContainBatchSize];
+  uint32_t tag[kContainBatchSize];
+
+  for (size_t base = 0; base < n; base += kContainBatchSize) {
+    const size_t count = std::min(kContainBatchSize, n - base);
+
+    // Hash the whole group first and get the loads of its buckets in flight
+    for (size_t k = 0; k < count; k++) {
+      GenerateIndexTagHash(keys[base + k], &i1[k], &tag[k]);
+      i2[k] = AltIndex(i1[k], tag[k]);
+      table_->PrefetchBucket(i1[k]);
+      table_->PrefetchBucket(i2[k]);
+    }
+
+    uint8_t found[kContainBatchSize];
+    table_->FindTagInBucketsBatch(i1, i2, tag, count, found);
+    if (stash_size_ != 0) {
+      for (size_t k = 0; k < count; k++) {
+        found[k] |= StashContains(i1[k], i2[k], tag[k]);
+      }
+    }
+    for (size_t k = 0; k < count; k++) {
+      results[base + k] = found[k] ? Ok : NotFound;
+    }
+  }
+}
+
 template <typename ItemType, size_t bits_per_item,
           template <size_t> class TableType, typename HashFamily>
 Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Delete(
@@ -323,28 +1030,614 @@ Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Delete(
   GenerateIndexTagHash(key, &i1, &tag);
   i2 = AltIndex(i1, tag);
 
-  if (table_->DeleteTagFromBucket(i1, tag)) {
+  if (table_->DeleteTagFromBucket(i1, tag) ||
+      table_->DeleteTagFromBucket(i2, tag)) {
     num_items_--;
-    goto TryEliminateVictim;
-  } else if (table_->DeleteTagFromBucket(i2, tag)) {
+    if (stash_size_ != 0) {
+      Unstash();
+    }
+    return Ok;
+  } else if (stash_size_ != 0 && StashRemove(i1, i2, tag)) {
     num_items_--;
-    goto TryEliminateVictim;
-  } else if (victim_.used && tag == victim_.tag &&
-             (i1 == victim_.index || i2 == victim_.index)) {
-    // num_items_--;
-    victim_.used = false;
     return Ok;
   } else {
     return NotFound;
   }
-TryEliminateVictim:
-  if (victim_.used) {
-    victim_.used = false;
-    AddImpl(victim_.index, victim_.tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Merge(
+    const CuckooFilter &other, const size_t num_threads) {
+  if (!HashesLike(other)) {
+    return NotSupported;
+  }
+
+  // A write to a bucket may touch the bytes of the next few, so the chunks
+  // next to each other are never copied at the same time: the even ones go
+  // first, then the odd ones
+  const size_t num_chunks =
+      (table_->NumBuckets() + kBucketChunkSize - 1) / kBucketChunkSize;
+  std::vector<std::vector<VictimCache>> overflow(num_chunks);
+  std::vector<size_t> copied(num_chunks);
+  for (size_t parity = 0; parity < 2; parity++) {
+    ParallelFor((num_chunks + 1 - parity) / 2, num_threads, [&](size_t k) {
+      const size_t c = 2 * k + parity;
+      const size_t begin = c * kBucketChunkSize;
+      const size_t end = std::min(begin + kBucketChunkSize, table_->NumBuckets());
+      copied[c] = MergeBuckets(other, begin, end, &overflow[c]);
+    });
+  }
+  for (size_t c = 0; c < num_chunks; c++) {
+    num_items_ += copied[c];
+  }
+
+  overflow.push_back(std::vector<VictimCache>(
+      other.stash_, other.stash_ + other.stash_size_));
+  for (const std::vector<VictimCache> &victims : overflow) {
+    for (const VictimCache &victim : victims) {
+      if (stash_size_ == kStashSize) {
+        return NotEnoughSpace;
+      }
+      AddImpl(victim.index, victim.tag);
+    }
   }
   return Ok;
 }
 
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+size_t CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::
+    MergeBuckets(const CuckooFilter &other, const size_t begin,
+                 const size_t end, std::vector<VictimCache> *overflow) {
+  size_t copied = 0;
+  uint32_t oldtag;
+  for (size_t i = begin; i < end; i++) {
+    if (i % kEmptyRunBuckets == 0 &&
+        other.table_->BucketsEmpty(i, std::min(i + kEmptyRunBuckets, end))) {
+      i += kEmptyRunBuckets - 1;
+      continue;
+    }
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      const uint32_t tag = other.table_->ReadTag(i, j);
+      if (tag == 0) {
+        continue;
+      }
+      if (table_->InsertTagToBucket(i, tag, false, oldtag)) {
+        copied++;
+      } else {
+        overflow->push_back(VictimCache{i, tag, true});
+      }
+    }
+  }
+  return copied;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Subtract(
+    const CuckooFilter &other, const size_t num_threads) {
+  if (!HashesLike(other)) {
+    return NotSupported;
+  }
+
+  // As in Merge, chunks next to each other are never written at the same
+  // time
+  const size_t num_chunks =
+      (table_->NumBuckets() + kBucketChunkSize - 1) / kBucketChunkSize;
+  std::vector<std::vector<VictimCache>> missing(num_chunks);
+  std::vector<size_t> deleted(num_chunks);
+  for (size_t parity = 0; parity < 2; parity++) {
+    ParallelFor((num_chunks + 1 - parity) / 2, num_threads, [&](size_t k) {
+      const size_t c = 2 * k + parity;
+      const size_t begin = c * kBucketChunkSize;
+      const size_t end = std::min(begin + kBucketChunkSize, table_->NumBuckets());
+      deleted[c] = SubtractBuckets(other, begin, end, &missing[c]);
+    });
+  }
+  for (size_t c = 0; c < num_chunks; c++) {
+    num_items_ -= deleted[c];
+  }
+
+  Status status = Ok;
+  missing.push_back(std::vector<VictimCache>(
+      other.stash_, other.stash_ + other.stash_size_));
+  for (const std::vector<VictimCache> &victims : missing) {
+    for (const VictimCache &victim : victims) {
+      const size_t i1 = victim.index;
+      const size_t i2 = AltIndex(i1, victim.tag);
+      if (table_->DeleteTagFromBucket(i1, victim.tag) ||
+          table_->DeleteTagFromBucket(i2, victim.tag) ||
+          StashRemove(i1, i2, victim.tag)) {
+        num_items_--;
+      } else {
+        status = NotFound;
+      }
+    }
+  }
+
+  // Each Unstash moves at most one stashed tag back into the table
+  for (size_t s = stash_size_; s > 0; s--) {
+    Unstash();
+  }
+  return status;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+size_t CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::
+    SubtractBuckets(const CuckooFilter &other, const size_t begin,
+                    const size_t end, std::vector<VictimCache> *missing) {
+  size_t deleted = 0;
+  for (size_t i = begin; i < end; i++) {
+    if (i % kEmptyRunBuckets == 0 &&
+        other.table_->BucketsEmpty(i, std::min(i + kEmptyRunBuckets, end))) {
+      i += kEmptyRunBuckets - 1;
+      continue;
+    }
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      const uint32_t tag = other.table_->ReadTag(i, j);
+      if (tag == 0) {
+        continue;
+      }
+      if (table_->DeleteTagFromBucket(i, tag)) {
+        deleted++;
+      } else {
+        missing->push_back(VictimCache{i, tag, true});
+      }
+    }
+  }
+  return deleted;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::BulkBuild(
+    const ItemType *keys, const size_t n, const size_t num_threads) {
+  std::vector<BulkEntry> entries, overflow;
+  std::vector<size_t> chunk_begin;
+
+  // Every key to its first bucket, then those that did not fit to their
+  // other one
+  PartitionEntries(n, num_threads, [&](size_t k) {
+    size_t i;
+    uint32_t tag;
+    GenerateIndexTagHash(keys[k], &i, &tag);
+    return BulkEntry{(uint32_t)i, tag};
+  }, &entries, &chunk_begin);
+  FillChunks(entries, chunk_begin, num_threads, &overflow);
+
+  std::vector<BulkEntry> spill;
+  spill.swap(overflow);
+  PartitionEntries(spill.size(), num_threads,
+                   [&](size_t k) { return spill[k]; }, &entries, &chunk_begin);
+  spill = std::vector<BulkEntry>();
+  FillChunks(entries, chunk_begin, num_threads, &overflow);
+  entries = std::vector<BulkEntry>();
+
+  for (const BulkEntry &entry : overflow) {
+    if (stash_size_ == kStashSize) {
+      return NotEnoughSpace;
+    }
+    AddImpl(entry.index, entry.tag);
+  }
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+template <typename Get>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::
+    PartitionEntries(const size_t n, size_t num_threads, const Get &get,
+                     std::vector<BulkEntry> *entries,
+                     std::vector<size_t> *chunk_begin) const {
+  num_threads = std::max<size_t>(1, std::min(num_threads, n));
+  const size_t num_chunks =
+      (table_->NumBuckets() + kBucketChunkSize - 1) / kBucketChunkSize;
+
+  // Count the entries of each thread's run of k by chunk
+  std::vector<size_t> offsets(num_threads * num_chunks);
+  ParallelFor(num_threads, num_threads, [&](size_t t) {
+    size_t *count = &offsets[t * num_chunks];
+    for (size_t k = n * t / num_threads; k < n * (t + 1) / num_threads; k++) {
+      count[get(k).index / kBucketChunkSize]++;
+    }
+  });
+
+  // Where the entries of each chunk and thread go: chunk by chunk, and
+  // within a chunk thread by thread
+  chunk_begin->resize(num_chunks + 1);
+  size_t offset = 0;
+  for (size_t c = 0; c < num_chunks; c++) {
+    (*chunk_begin)[c] = offset;
+    for (size_t t = 0; t < num_threads; t++) {
+      size_t count = offsets[t * num_chunks + c];
+      offsets[t * num_chunks + c] = offset;
+      offset += count;
+    }
+  }
+  (*chunk_begin)[num_chunks] = offset;
+
+  entries->resize(n);
+  ParallelFor(num_threads, num_threads, [&](size_t t) {
+    size_t *offset = &offsets[t * num_chunks];
+    for (size_t k = n * t / num_threads; k < n * (t + 1) / num_threads; k++) {
+      const BulkEntry entry = get(k);
+      (*entries)[offset[entry.index / kBucketChunkSize]++] = entry;
+    }
+  });
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::FillChunks(
+    const std::vector<BulkEntry> &entries,
+    const std::vector<size_t> &chunk_begin, const size_t num_threads,
+    std::vector<BulkEntry> *overflow) {
+  const size_t num_chunks = chunk_begin.size() - 1;
+  std::vector<std::vector<BulkEntry>> left(num_chunks);
+  std::vector<size_t> added(num_chunks);
+
+  // As in Merge, chunks next to each other are never filled at the same time
+  for (size_t parity = 0; parity < 2; parity++) {
+    ParallelFor((num_chunks + 1 - parity) / 2, num_threads, [&](size_t k) {
+      const size_t c = 2 * k + parity;
+      uint32_t oldtag;
+      for (size_t e = chunk_begin[c]; e < chunk_begin[c + 1]; e++) {
+        const BulkEntry &entry = entries[e];
+        if (table_->InsertTagToBucket(entry.index, entry.tag, false, oldtag)) {
+          added[c]++;
+        } else {
+          left[c].push_back(BulkEntry{
+              (uint32_t)AltIndex(entry.index, entry.tag), entry.tag});
+        }
+      }
+    });
+  }
+
+  for (size_t c = 0; c < num_chunks; c++) {
+    num_items_ += added[c];
+    overflow->insert(overflow->end(), left[c].begin(), left[c].end());
+  }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::
+    SaveCompressedTo(std::ostream &os, const size_t num_threads) const {
+  const size_t num_chunks =
+      (table_->NumBuckets() + kBucketChunkSize - 1) / kBucketChunkSize;
+  std::vector<std::vector<unsigned char>> chunks(num_chunks);
+  std::vector<uint32_t> crcs(num_chunks);
+  ParallelFor(num_chunks, num_threads, [&](size_t c) {
+    const size_t begin = c * kBucketChunkSize;
+    EncodeChunk(begin, std::min(begin + kBucketChunkSize, table_->NumBuckets()),
+                &chunks[c]);
+    crcs[c] = Crc32c(0, chunks[c].data(), chunks[c].size());
+  });
+
+  std::vector<uint64_t> ends(num_chunks);
+  uint64_t end = 0;
+  for (size_t c = 0; c < num_chunks; c++) {
+    end += chunks[c].size();
+    ends[c] = end;
+  }
+  const size_t index_size = num_chunks * sizeof(uint64_t);
+
+  SavedHeader sh;
+  BuildHeader(&sh, kCompressed);
+  sh.data_size_ = index_size + end;
+  sh.data_crc_ = Crc32c(0, ends.data(), index_size);
+  for (size_t c = 0; c < num_chunks; c++) {
+    sh.data_crc_ = Crc32cCombine(sh.data_crc_, crcs[c], chunks[c].size());
+  }
+  sh.header_crc_ = HeaderCrc(sh);
+
+  os.write(reinterpret_cast<const char *>(&sh), sizeof(sh));
+  os.write(reinterpret_cast<const char *>(ends.data()), index_size);
+  for (const std::vector<unsigned char> &chunk : chunks) {
+    os.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+  }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::EncodeChunk(
+    const size_t begin, const size_t end,
+    std::vector<unsigned char> *out) const {
+  std::vector<uint32_t> tags;
+  tags.reserve((end - begin) * kTagsPerBucket);
+  size_t num_tags = 0;
+  for (size_t i = begin; i < end; i++) {
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      tags.push_back(table_->ReadTag(i, j));
+      num_tags += (tags.back() != 0);
+    }
+  }
+
+  const bool masked =
+      tags.size() + num_tags * bits_per_item < tags.size() * bits_per_item;
+  const size_t mask_size = masked ? (tags.size() + 7) / 8 : 0;
+  const size_t tags_size =
+      ((masked ? num_tags : tags.size()) * bits_per_item + 7) / 8;
+  const size_t offset = out->size();
+  out->resize(offset + 1 + mask_size + tags_size);
+  unsigned char *p = out->data() + offset;
+  p[0] = masked ? kChunkMasked : kChunkPlain;
+  BitWriter mask(p + 1);
+  BitWriter writer(p + 1 + mask_size);
+  for (uint32_t tag : tags) {
+    if (masked) {
+      mask.Put(tag != 0, 1);
+    }
+    if (!masked || tag != 0) {
+      writer.Put(tag, bits_per_item);
+    }
+  }
+  mask.Flush();
+  writer.Flush();
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::DecodeChunk(
+    const size_t begin, const size_t end, const unsigned char *p,
+    const size_t len) {
+  if (len == 0 || p[0] > kChunkMasked) {
+    return false;
+  }
+  const bool masked = p[0] == kChunkMasked;
+  const size_t num_slots = (end - begin) * kTagsPerBucket;
+  const size_t mask_size = masked ? (num_slots + 7) / 8 : 0;
+  if (1 + mask_size > len) {
+    return false;
+  }
+  BitReader mask(p + 1, p + 1 + mask_size);
+  BitReader tags(p + 1 + mask_size, p + len);
+  uint32_t oldtag;
+  for (size_t i = begin; i < end; i++) {
+    // one bit per slot that holds a tag
+    const uint32_t slots = masked ? mask.Get(kTagsPerBucket)
+                                  : (1U << kTagsPerBucket) - 1;
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      const uint32_t tag = (slots >> j & 1) ? tags.Get(bits_per_item) : 0;
+      if (tag == 0) {
+        continue;
+      }
+      if (TableType<bits_per_item>::kStableSlots) {
+        table_->WriteTag(i, j, tag);
+      } else {
+        table_->InsertTagToBucket(i, tag, false, oldtag);
+      }
+    }
+  }
+  return !mask.Overrun() && !tags.Overrun();
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::
+    LoadCompressed(const SavedHeader &sh, const unsigned char *data,
+                   const bool verify_checksum, const size_t num_threads) {
+  const size_t num_chunks =
+      (sh.num_buckets_ + kBucketChunkSize - 1) / kBucketChunkSize;
+  const size_t index_size = num_chunks * sizeof(uint64_t);
+  if (index_size > sh.data_size_) {
+    return false;
+  }
+  std::vector<uint64_t> ends(num_chunks);
+  memcpy(ends.data(), data, index_size);
+  for (size_t c = 0; c < num_chunks; c++) {
+    if (ends[c] < (c > 0 ? ends[c - 1] : 0)) {
+      return false;
+    }
+  }
+  if (num_chunks > 0 && ends.back() != sh.data_size_ - index_size) {
+    return false;
+  }
+
+  try {
+    table_ = new TableType<bits_per_item>(sh.num_buckets_);
+  } catch (std::bad_alloc& ba) {
+    return false;
+  }
+  if (table_->NumBuckets() != sh.num_buckets_) {
+    delete table_;
+    table_ = nullptr;
+    return false;
+  }
+
+  // As in Merge, chunks next to each other are never decoded at the same
+  // time
+  const unsigned char *chunks = data + index_size;
+  std::vector<char> decoded(num_chunks);
+  std::vector<uint32_t> crcs(num_chunks);
+  for (size_t parity = 0; parity < 2; parity++) {
+    ParallelFor((num_chunks + 1 - parity) / 2, num_threads, [&](size_t k) {
+      const size_t c = 2 * k + parity;
+      const size_t offset = c > 0 ? ends[c - 1] : 0;
+      const size_t begin = c * kBucketChunkSize;
+      if (verify_checksum) {
+        crcs[c] = Crc32c(0, chunks + offset, ends[c] - offset);
+      }
+      decoded[c] = DecodeChunk(
+          begin, std::min<size_t>(begin + kBucketChunkSize, sh.num_buckets_),
+          chunks + offset, ends[c] - offset);
+    });
+  }
+
+  bool ok = std::find(decoded.begin(), decoded.end(), false) == decoded.end();
+  if (ok && verify_checksum) {
+    uint32_t crc = Crc32c(0, data, index_size);
+    for (size_t c = 0; c < num_chunks; c++) {
+      crc = Crc32cCombine(crc, crcs[c], ends[c] - (c > 0 ? ends[c - 1] : 0));
+    }
+    ok = crc == sh.data_crc_;
+  }
+  if (!ok) {
+    delete table_;
+    table_ = nullptr;
+  }
+  return ok;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::SaveDeltaTo(
+    const CuckooFilter &base, std::ostream &os) const {
+  const unsigned char *old_data = base.table_->Data();
+  const unsigned char *new_data = table_->Data();
+  const size_t size = table_->SizeInBytes();
+
+  // Runs of differing words, joined when they are closer than the
+  // DeltaRange a new run would take. Pages are compared whole first, as
+  // most of them are the same.
+  const size_t kPageSize = 4096;
+  std::vector<DeltaRange> ranges;
+  for (size_t page = 0; page < size; page += kPageSize) {
+    const size_t page_end = std::min(size, page + kPageSize);
+    if (memcmp(old_data + page, new_data + page, page_end - page) == 0) {
+      continue;
+    }
+    for (size_t offset = page; offset < page_end; offset += kDeltaWordSize) {
+      const size_t n = std::min(kDeltaWordSize, size - offset);
+      if (memcmp(old_data + offset, new_data + offset, n) == 0) {
+        continue;
+      }
+      if (!ranges.empty() &&
+          offset - (ranges.back().offset_ + ranges.back().length_) <=
+              sizeof(DeltaRange)) {
+        ranges.back().length_ = offset + n - ranges.back().offset_;
+      } else {
+        ranges.push_back(DeltaRange{offset, n, 0, 0});
+      }
+    }
+  }
+
+  const uint64_t num_ranges = ranges.size();
+  uint64_t data_size = sizeof(num_ranges) + num_ranges * sizeof(DeltaRange);
+  for (DeltaRange &range : ranges) {
+    range.old_crc_ = Crc32c(0, old_data + range.offset_, range.length_);
+    range.new_crc_ = Crc32c(0, new_data + range.offset_, range.length_);
+    data_size += range.length_;
+  }
+
+  SavedHeader sh;
+  BuildHeader(&sh, kDelta);
+  sh.data_size_ = data_size;
+  sh.data_crc_ = Crc32c(0, &num_ranges, sizeof(num_ranges));
+  sh.data_crc_ =
+      Crc32c(sh.data_crc_, ranges.data(), num_ranges * sizeof(DeltaRange));
+  for (const DeltaRange &range : ranges) {
+    sh.data_crc_ = Crc32c(sh.data_crc_, new_data + range.offset_, range.length_);
+  }
+  sh.header_crc_ = HeaderCrc(sh);
+
+  os.write(reinterpret_cast<const char *>(&sh), sizeof(sh));
+  os.write(reinterpret_cast<const char *>(&num_ranges), sizeof(num_ranges));
+  os.write(reinterpret_cast<const char *>(ranges.data()),
+           num_ranges * sizeof(DeltaRange));
+  for (const DeltaRange &range : ranges) {
+    os.write(reinterpret_cast<const char *>(new_data + range.offset_),
+             range.length_);
+  }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+Status CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::ApplyDelta(
+    const void *addr, const size_t length) {
+  SavedHeader sh;
+  if (length < sizeof(sh)) {
+    return NotSupported;
+  }
+  memcpy(&sh, addr, sizeof(sh));
+  unsigned char hash_data[sizeof(sh.hash_data_)];
+  memset(hash_data, 0, sizeof(hash_data));
+  hasher_.save(hash_data, sizeof(hash_data));
+  if (!ValidHeader(sh) || !(sh.flags_ & kDelta) ||
+      sh.bits_per_item_ != bits_per_item ||
+      sh.table_id_ != TableType<bits_per_item>::kFormatId ||
+      sh.hash_id_ != HashFamily::kFormatId ||
+      sh.num_buckets_ != table_->NumBuckets() ||
+      memcmp(sh.hash_data_, hash_data, sizeof(hash_data)) != 0 ||
+      sh.data_size_ > length - sizeof(sh)) {
+    return NotSupported;
+  }
+  for (size_t s = 0; s < sh.stash_size_; s++) {
+    if (sh.stash_[s].index >= sh.num_buckets_) {
+      return NotSupported;
+    }
+  }
+  const unsigned char *data = (const unsigned char *)addr + sizeof(sh);
+  if (Crc32c(0, data, sh.data_size_) != sh.data_crc_) {
+    return NotSupported;
+  }
+
+  uint64_t num_ranges;
+  if (sh.data_size_ < sizeof(num_ranges)) {
+    return NotSupported;
+  }
+  memcpy(&num_ranges, data, sizeof(num_ranges));
+  if (num_ranges > (sh.data_size_ - sizeof(num_ranges)) / sizeof(DeltaRange)) {
+    return NotSupported;
+  }
+  std::vector<DeltaRange> ranges(num_ranges);
+  memcpy(ranges.data(), data + sizeof(num_ranges),
+         num_ranges * sizeof(DeltaRange));
+
+  // Check every range before patching any
+  unsigned char *table_data = table_->Data();
+  const size_t size = table_->SizeInBytes();
+  const unsigned char *bytes =
+      data + sizeof(num_ranges) + num_ranges * sizeof(DeltaRange);
+  const unsigned char *end = data + sh.data_size_;
+  for (const DeltaRange &range : ranges) {
+    if (range.offset_ > size || range.length_ > size - range.offset_ ||
+        range.length_ > (size_t)(end - bytes) ||
+        Crc32c(0, table_data + range.offset_, range.length_) !=
+            range.old_crc_ ||
+        Crc32c(0, bytes, range.length_) != range.new_crc_) {
+      return NotSupported;
+    }
+    bytes += range.length_;
+  }
+  if (bytes != end) {
+    return NotSupported;
+  }
+
+  bytes = data + sizeof(num_ranges) + num_ranges * sizeof(DeltaRange);
+  for (const DeltaRange &range : ranges) {
+    memcpy(table_data + range.offset_, bytes, range.length_);
+    bytes += range.length_;
+  }
+  num_items_ = sh.num_items_;
+  for (size_t s = 0; s < kStashSize; s++) {
+    stash_[s].index = sh.stash_[s].index;
+    stash_[s].tag = sh.stash_[s].tag;
+    stash_[s].used = s < sh.stash_size_;
+  }
+  stash_size_ = sh.stash_size_;
+  return Ok;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Unstash() {
+  PathStep path[kMaxCuckooCount + 1];
+  for (size_t s = 0; s < stash_size_; s++) {
+    const size_t i1 = stash_[s].index;
+    const uint32_t tag = stash_[s].tag;
+    size_t len = FindPath(i1, AltIndex(i1, tag), path);
+    if (len > 0) {
+      ApplyPath(path, len, tag);
+      stash_[s] = stash_[--stash_size_];
+      stash_[stash_size_].used = false;
+      return;
+    }
+  }
+}
+
 template <typename ItemType, size_t bits_per_item,
           template <size_t> class TableType, typename HashFamily>
 std::string CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Info() const {
@@ -352,6 +1645,7 @@ std::string CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Info()
   ss << "CuckooFilter Status:\n"
      << "\t\t" << table_->Info() << "\n"
      << "\t\tKeys stored: " << Size() << "\n"
+     << "\t\tKeys stashed: " << stash_size_ << "\n"
      << "\t\tLoad factor: " << LoadFactor() << "\n"
      << "\t\tHashtable size: " << (table_->SizeInBytes()) << " bytes\n";
   if (Size() > 0) {
@@ -366,35 +1660,53 @@ std::string CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>::Info()
 static inline bool SavedInfo(const std::string &path, size_t &bits_per_item,
                              size_t &num_buckets, size_t &num_items,
                              size_t &data_size) {
-  // Create a structure that matches the beginning of the SaveHeader structure
-  struct hdr {
-    size_t bits_per_item_;
-    size_t num_buckets_;
-    size_t num_items_;
-    uint64_t data_size_;
-  } hdr = {0};
-
-  std::ifstream rf(path, std::ios::in | std::ios::binary | std::ios::ate);
+  SavedHeader sh;
+  std::ifstream rf(path, std::ios::in | std::ios::binary);
   if (!rf) {
     return false;
   }
-  size_t size = rf.tellg();
-  rf.seekg(0);
-  if (size < sizeof(hdr)) {
-    return false;
-  }
-  if (!rf.read((char *)&hdr, sizeof(hdr))) {
+  if (!rf.read((char *)&sh, sizeof(sh)) || !ValidHeader(sh)) {
     return false;
   }
   rf.close();
 
-  bits_per_item = hdr.bits_per_item_;
-  num_items = hdr.num_items_;
-  num_buckets = hdr.num_buckets_;
-  data_size = hdr.data_size_;
+  bits_per_item = sh.bits_per_item_;
+  num_items = sh.num_items_;
+  num_buckets = sh.num_buckets_;
+  data_size = sh.data_size_;
 
   return true;
 }
 
+// Check the filter saved at path against its checksums in one streaming
+// pass, without loading it. Whether its template parameters are the ones
+// expected is only checked when it is loaded, and the table of a file whose
+// checksum is stale is not checked.
+static inline bool VerifySaved(const std::string &path) {
+  SavedHeader sh;
+  std::ifstream rf(path, std::ios::in | std::ios::binary);
+  if (!rf) {
+    return false;
+  }
+  if (!rf.read((char *)&sh, sizeof(sh)) || !ValidHeader(sh)) {
+    return false;
+  }
+
+  if (sh.flags_ & kTableCrcStale) {
+    return true;
+  }
+  std::vector<char> buf(1 << 20);
+  uint32_t crc = 0;
+  for (uint64_t left = sh.data_size_; left > 0;) {
+    size_t n = std::min<uint64_t>(left, buf.size());
+    if (!rf.read(buf.data(), n)) {
+      return false;
+    }
+    crc = Crc32c(crc, buf.data(), n);
+    left -= n;
+  }
+  return crc == sh.data_crc_;
+}
+
 }  // namespace cuckoofilter
 #endif  // CUCKOO_FILTER_CUCKOO_FILTER_H_
@@ -0,0 +1,311 @@
+#ifndef CUCKOO_FILTER_DYNAMIC_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_DYNAMIC_CUCKOO_FILTER_H_
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+#include "cuckoofilter.h"
+
+namespace cuckoofilter {
+
+// A cuckoo filter whose bits_per_item is chosen at runtime, any width from 2
+// to 32 bits.
+//
+// Going through BaseCuckooFilter for that costs a virtual call per item,
+// which keeps the hashing and probing out of the caller's loop. Here every
+// call finds the width once, with a binary search over the 31 widths that
+// the compiler unrolls into a few compares, and then makes a direct,
+// inlinable call of the CuckooFilter of that width; the batch methods find
+// it once per batch.
+// Visit runs any code against the filter of the right width, so a whole loop
+// can be compiled for it; a const filter is visited as a const CuckooFilter:
+//
+//   struct CountHits {
+//     const std::vector<uint64_t> &keys;
+//     template <typename Filter>
+//     size_t operator()(const Filter &filter) const {
+//       size_t hits = 0;
+//       for (uint64_t key : keys) {
+//         hits += (filter.Filter::Contain(key) == cuckoofilter::Ok);
+//       }
+//       return hits;
+//     }
+//   };
+//   size_t hits = filter.Visit<size_t>(CountHits{keys});
+//
+// The qualified Filter::Contain makes the call non-virtual.
+template <typename ItemType, template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class DynamicCuckooFilter : public BaseCuckooFilter<ItemType> {
+  template <size_t bits_per_item>
+  using Filter = CuckooFilter<ItemType, bits_per_item, TableType, HashFamily>;
+
+  size_t bits_per_item_;
+  std::unique_ptr<BaseCuckooFilter<ItemType>> filter_;
+
+  static const size_t kMinBitsPerItem = 2;
+  static const size_t kMaxBitsPerItem = 32;
+
+  template <size_t bits_per_item>
+  using Width = std::integral_constant<size_t, bits_per_item>;
+
+  // Is [lo, hi) a single width
+  template <size_t lo, size_t hi>
+  using OneWidth = std::integral_constant<bool, hi - lo == 1>;
+
+  // Return fn(Width<bits_per_item>()), for bits_per_item in [lo, hi)
+  template <typename Result, size_t lo, size_t hi, typename Fn>
+  static Result Dispatch(const size_t, const Fn &fn, std::true_type) {
+    return fn(Width<lo>());
+  }
+
+  template <typename Result, size_t lo, size_t hi, typename Fn>
+  static Result Dispatch(const size_t bits_per_item, const Fn &fn,
+                         std::false_type) {
+    static const size_t mid = (lo + hi) / 2;
+    return bits_per_item < mid
+               ? Dispatch<Result, lo, mid>(bits_per_item, fn,
+                                           OneWidth<lo, mid>())
+               : Dispatch<Result, mid, hi>(bits_per_item, fn,
+                                           OneWidth<mid, hi>());
+  }
+
+  // Return fn(Width<bits_per_item>()) for a supported bits_per_item
+  template <typename Result, typename Fn>
+  static Result ForWidth(const size_t bits_per_item, const Fn &fn) {
+    return Dispatch<Result, kMinBitsPerItem, kMaxBitsPerItem + 1>(
+        bits_per_item, fn, std::false_type());
+  }
+
+  // Build the filter of a width, for max_num_keys keys, from the file at
+  // path or from the buffer at addr
+  struct NewFromKeys {
+    size_t max_num_keys;
+    template <size_t bits>
+    BaseCuckooFilter<ItemType> *operator()(Width<bits>) const {
+      return new (std::nothrow) Filter<bits>(max_num_keys);
+    }
+  };
+
+  struct NewFromFile {
+    const std::string &path;
+    template <size_t bits>
+    BaseCuckooFilter<ItemType> *operator()(Width<bits>) const {
+      return new (std::nothrow) Filter<bits>(path);
+    }
+  };
+
+  struct NewFromBuffer {
+    void *addr;
+    size_t length;
+    template <size_t bits>
+    BaseCuckooFilter<ItemType> *operator()(Width<bits>) const {
+      return new (std::nothrow) Filter<bits>(addr, length);
+    }
+  };
+
+  // Call fn with filter as the CuckooFilter of its width, const if Base is
+  template <typename Result, typename Base, typename Fn>
+  struct VisitFn {
+    Base *filter;
+    const Fn &fn;
+    template <size_t bits>
+    Result operator()(Width<bits>) const {
+      typedef typename std::conditional<std::is_const<Base>::value,
+                                        const Filter<bits>, Filter<bits>>::type
+          Visited;
+      return fn(*static_cast<Visited *>(filter));
+    }
+  };
+
+  // The calls Visit makes for the members below
+  struct AddFn {
+    const ItemType &item;
+    template <typename F>
+    Status operator()(F &filter) const { return filter.F::Add(item); }
+  };
+
+  struct ContainFn {
+    const ItemType &item;
+    template <typename F>
+    Status operator()(const F &filter) const {
+      return filter.F::Contain(item);
+    }
+  };
+
+  struct DeleteFn {
+    const ItemType &item;
+    template <typename F>
+    Status operator()(F &filter) const { return filter.F::Delete(item); }
+  };
+
+  struct AddBatchFn {
+    const ItemType *keys;
+    size_t n;
+    uint8_t *results;
+    template <typename F>
+    int operator()(F &filter) const {
+      for (size_t k = 0; k < n; k++) {
+        results[k] = filter.F::Add(keys[k]);
+      }
+      return 0;
+    }
+  };
+
+  struct ContainBatchFn {
+    const ItemType *keys;
+    size_t n;
+    uint8_t *results;
+    template <typename F>
+    int operator()(const F &filter) const {
+      filter.F::ContainBatch(keys, n, results);
+      return 0;
+    }
+  };
+
+  struct DeleteBatchFn {
+    const ItemType *keys;
+    size_t n;
+    uint8_t *results;
+    template <typename F>
+    int operator()(F &filter) const {
+      for (size_t k = 0; k < n; k++) {
+        results[k] = filter.F::Delete(keys[k]);
+      }
+      return 0;
+    }
+  };
+
+ public:
+  // Returns if filters of bits_per_item bits per item are supported
+  static bool Supported(const size_t bits_per_item) {
+    return bits_per_item >= kMinBitsPerItem && bits_per_item <= kMaxBitsPerItem;
+  }
+
+  // Build a filter of bits_per_item bits per item for max_num_keys keys.
+  // Caller should call Valid() to ensure filter is built, which it is not
+  // for an unsupported width; BitsPerItem() is then 0.
+  DynamicCuckooFilter(const size_t bits_per_item, const size_t max_num_keys)
+      : bits_per_item_(Supported(bits_per_item) ? bits_per_item : 0) {
+    if (bits_per_item_ != 0) {
+      filter_.reset(ForWidth<BaseCuckooFilter<ItemType> *>(
+          bits_per_item_, NewFromKeys{max_num_keys}));
+    }
+  }
+
+  // Load the filter saved at path, of the width it was saved with
+  explicit DynamicCuckooFilter(const std::string &path) : bits_per_item_(0) {
+    size_t num_buckets, num_items, data_size;
+    if (!SavedInfo(path, bits_per_item_, num_buckets, num_items, data_size) ||
+        !Supported(bits_per_item_)) {
+      bits_per_item_ = 0;
+      return;
+    }
+    filter_.reset(ForWidth<BaseCuckooFilter<ItemType> *>(bits_per_item_,
+                                                         NewFromFile{path}));
+  }
+
+  // Load a filter of bits_per_item bits per item from the specified buffer.
+  // We will not own the data we read in, so the caller better not free it...
+  DynamicCuckooFilter(const size_t bits_per_item, void *addr, size_t length)
+      : bits_per_item_(Supported(bits_per_item) ? bits_per_item : 0) {
+    if (bits_per_item_ != 0) {
+      filter_.reset(ForWidth<BaseCuckooFilter<ItemType> *>(
+          bits_per_item_, NewFromBuffer{addr, length}));
+    }
+  }
+
+  // Call fn with the CuckooFilter of the runtime width and return what it
+  // returns, or Result() without calling it if no filter of a supported
+  // width was built. Only call it on a Valid() filter.
+  template <typename Result, typename Fn>
+  Result Visit(const Fn &fn) {
+    if (bits_per_item_ == 0) {
+      return Result();
+    }
+    typedef BaseCuckooFilter<ItemType> Base;
+    return ForWidth<Result>(bits_per_item_,
+                            VisitFn<Result, Base, Fn>{filter_.get(), fn});
+  }
+
+  // Visit for a const filter, which fn gets as a const CuckooFilter
+  template <typename Result, typename Fn>
+  Result Visit(const Fn &fn) const {
+    if (bits_per_item_ == 0) {
+      return Result();
+    }
+    typedef const BaseCuckooFilter<ItemType> Base;
+    return ForWidth<Result>(bits_per_item_,
+                            VisitFn<Result, Base, Fn>{filter_.get(), fn});
+  }
+
+  size_t BitsPerItem() const { return bits_per_item_; }
+
+  // Add an item to the filter; NotSupported for an unsupported width.
+  Status Add(const ItemType &item) {
+    return bits_per_item_ ? Visit<Status>(AddFn{item}) : NotSupported;
+  }
+
+  // Report if the item is inserted, with false positive rate.
+  Status Contain(const ItemType &item) const {
+    return bits_per_item_ ? Visit<Status>(ContainFn{item}) : NotSupported;
+  }
+
+  // Delete an key from the filter
+  Status Delete(const ItemType &item) {
+    return bits_per_item_ ? Visit<Status>(DeleteFn{item}) : NotSupported;
+  }
+
+  // Add each of the n keys; results[i] is set to the Status of Add(keys[i])
+  void AddBatch(const ItemType *keys, size_t n, uint8_t *results) {
+    if (bits_per_item_ == 0) {
+      std::fill(results, results + n, NotSupported);
+      return;
+    }
+    Visit<int>(AddBatchFn{keys, n, results});
+  }
+
+  // Report for each of the n keys if it is inserted, see
+  // CuckooFilter::ContainBatch
+  void ContainBatch(const ItemType *keys, size_t n, uint8_t *results) const {
+    if (bits_per_item_ == 0) {
+      std::fill(results, results + n, NotSupported);
+      return;
+    }
+    Visit<int>(ContainBatchFn{keys, n, results});
+  }
+
+  // Delete each of the n keys; results[i] is set to the Status of
+  // Delete(keys[i])
+  void DeleteBatch(const ItemType *keys, size_t n, uint8_t *results) {
+    if (bits_per_item_ == 0) {
+      std::fill(results, results + n, NotSupported);
+      return;
+    }
+    Visit<int>(DeleteBatchFn{keys, n, results});
+  }
+
+  /* methods for providing stats  */
+  // summary infomation
+  std::string Info() const { return filter_ ? filter_->Info() : ""; }
+
+  // number of current inserted items;
+  size_t Size() const { return filter_ ? filter_->Size() : 0; }
+
+  // size of the filter in bytes.
+  size_t SizeInBytes() const { return filter_ ? filter_->SizeInBytes() : 0; }
+
+  // save the filter to a file
+  bool Save(const std::string path) const {
+    return filter_ && filter_->Save(path);
+  }
+
+  bool Valid() const {
+    // Valid means a filter of a supported width is built and loaded
+    return filter_ && filter_->Valid();
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_DYNAMIC_CUCKOO_FILTER_H_
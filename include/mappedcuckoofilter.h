@@ -0,0 +1,465 @@
+#ifndef CUCKOO_FILTER_MAPPED_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_MAPPED_CUCKOO_FILTER_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <future>
+#include <sstream>
+#include <vector>
+
+#include "cuckoofilter.h"
+
+namespace cuckoofilter {
+
+// What backs the memory of a MappedCuckooFilter
+enum HugePages {
+  // the file's pages in the page cache, shared with every process mapping it
+  kNoHugePages = 0,
+  // the same, advised to be backed by transparent huge pages, which only
+  // takes effect where the kernel does so for files (tmpfs, or
+  // CONFIG_READ_ONLY_THP_FOR_FS)
+  kTransparentHugePages = 1,
+  // a copy of the file in anonymous memory of explicit 2 MB huge pages from
+  // the reserved pool (vm.nr_hugepages), or of transparent huge pages if the
+  // pool is too small
+  kCopyToHugePages = 2,
+};
+
+// How MappedCuckooFilter maps a saved filter
+struct MapOptions {
+  // fault every page in while loading, rather than on the first lookups
+  bool populate = false;
+
+  HugePages huge_pages = kNoHugePages;
+
+  // mlock the filter, so that none of it is paged out; needs
+  // RLIMIT_MEMLOCK or CAP_IPC_LOCK
+  bool lock = false;
+
+  // place the filter's pages on this NUMA node, if not -1
+  int numa_node = -1;
+
+  // or spread them over all the nodes, page by page
+  bool numa_interleave = false;
+
+  // check the table against its checksum, which reads all of it
+  bool verify_checksum = true;
+
+  // map the file read/write and shared, so that Add and Delete modify it in
+  // place; not with kCopyToHugePages
+  bool writable = false;
+
+  // number of threads that read the file into a copy, or fault it in and
+  // check its checksum in the background
+  size_t load_threads = 1;
+
+  // return as soon as the header is checked and the file mapped, and fault
+  // the table in and check its checksum on load_threads background threads;
+  // see MappedCuckooFilter::Ready. Not for copies, which are read before
+  // the constructor returns.
+  bool background = false;
+};
+
+// A cuckoo filter loaded from a file Save wrote, by mapping the file rather
+// than reading it, so loading costs no copy and the page cache is shared by
+// every process that maps the same file. The mapping lives as long as the
+// filter does.
+//
+// For filters of several GB, lookups spend much of their time on TLB misses;
+// options.huge_pages backs the table with 2 MB pages, and the NUMA options
+// keep it next to the threads that probe it. A filter mapped from the file is
+// read only and Add, Delete and the other methods that modify it report
+// NotSupported, unless options.writable, also when called through a
+// CuckooFilter pointer; one copied to huge pages can be modified, without
+// the file changing.
+// Caller should call Valid(), and Error() tells why a filter did not load.
+//
+// A writable filter changes the file as it is modified: the tags in the
+// table, and the item count and stash in the header, which is rewritten
+// after every change. The kernel keeps track of the pages written, and
+// Sync() writes back only those, so persisting a few thousand changes to a
+// filter of several GB takes milliseconds rather than a Save of the whole
+// file. Recomputing the table checksum takes a pass over the whole table, so
+// it is only done by Sync(true) and when the filter is destroyed; until
+// then the header says the checksum is stale. The file must not be mapped
+// writable by two filters at once.
+//
+// With options.background, the filter can be queried as soon as it is
+// constructed, while background threads fault its pages in; a lookup that
+// gets to a page first faults it in itself. Ready() tells when the table is
+// resident and whether it matched its checksum.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class MappedCuckooFilter
+    : public CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> {
+  typedef CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> Filter;
+
+  // From linux/mempolicy.h
+  static const int kMpolBind = 2;
+  static const int kMpolInterleave = 3;
+  static const unsigned kMpolMfMove = 1 << 1;
+  static const size_t kHugePageSize = 2 << 20;
+
+  // bytes a loading thread reads or faults in at a time
+  static const size_t kLoadChunkSize = 4 << 20;
+
+  MapOptions options_;
+  void *addr_;
+  size_t length_;     // of the file
+  size_t map_length_; // of the mapping
+  bool copied_;       // the mapping is anonymous memory holding a copy
+  bool modified_;     // since the table checksum was computed
+  std::string error_;
+
+  // Whether the table is resident and matched its checksum
+  std::shared_future<bool> ready_;
+
+  // Write the item count and stash to the header in the mapping, with flags
+  void WriteHeader(const uint32_t flags) {
+    SavedHeader sh;
+    this->BuildHeader(&sh, flags);
+    memcpy(addr_, &sh, sizeof(sh));
+    modified_ = flags & kTableCrcStale;
+  }
+
+  bool Copy() const { return options_.huge_pages == kCopyToHugePages; }
+
+  bool Fail(const std::string &what) {
+    error_ = what + ": " + strerror(errno);
+    return false;
+  }
+
+  // Apply the NUMA options to the mapping, moving any pages already in it
+  bool Place() {
+    if (options_.numa_node < 0 && !options_.numa_interleave) {
+      return true;
+    }
+    unsigned long nodemask[16];
+    memset(nodemask, 0, sizeof(nodemask));
+    const size_t maxnode = 8 * sizeof(nodemask);
+    int mode;
+    if (options_.numa_interleave) {
+      memset(nodemask, 0xff, sizeof(nodemask));
+      mode = kMpolInterleave;
+    } else {
+      if ((size_t)options_.numa_node >= maxnode) {
+        errno = EINVAL;
+        return Fail("numa_node");
+      }
+      nodemask[options_.numa_node / 64] |= 1UL << (options_.numa_node % 64);
+      mode = kMpolBind;
+    }
+    if (syscall(SYS_mbind, addr_, map_length_, mode, nodemask, maxnode,
+                kMpolMfMove) != 0) {
+      return Fail("mbind");
+    }
+    return true;
+  }
+
+  bool MapFile(const int fd) {
+    map_length_ = length_;
+    addr_ = mmap(nullptr, map_length_,
+                 PROT_READ | (options_.writable ? PROT_WRITE : 0),
+                 MAP_SHARED | (options_.populate && !options_.background
+                                   ? MAP_POPULATE
+                                   : 0),
+                 fd, 0);
+    if (addr_ == MAP_FAILED) {
+      addr_ = nullptr;
+      return Fail("mmap");
+    }
+    if (options_.huge_pages == kTransparentHugePages) {
+      madvise(addr_, map_length_, MADV_HUGEPAGE);
+    }
+    return Place();
+  }
+
+  bool CopyFile(const int fd) {
+    map_length_ = (length_ + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    addr_ = mmap(nullptr, map_length_, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr_ == MAP_FAILED) {
+      addr_ = mmap(nullptr, map_length_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (addr_ == MAP_FAILED) {
+        addr_ = nullptr;
+        return Fail("mmap");
+      }
+      madvise(addr_, map_length_, MADV_HUGEPAGE);
+    }
+    copied_ = true;
+    // Before the pages are touched, so that they are allocated where asked
+    if (!Place()) {
+      return false;
+    }
+    const size_t num_chunks = (length_ + kLoadChunkSize - 1) / kLoadChunkSize;
+    std::vector<char> failed(num_chunks);
+    ParallelFor(num_chunks, options_.load_threads, [&](size_t c) {
+      const size_t end = std::min(length_, (c + 1) * kLoadChunkSize);
+      for (size_t offset = c * kLoadChunkSize; offset < end;) {
+        ssize_t n = pread(fd, static_cast<char *>(addr_) + offset,
+                          end - offset, offset);
+        if (n <= 0) {
+          if (n < 0 && errno == EINTR) {
+            continue;
+          }
+          failed[c] = true;
+          return;
+        }
+        offset += n;
+      }
+    });
+    if (std::find(failed.begin(), failed.end(), true) != failed.end()) {
+      return Fail("read");
+    }
+    return true;
+  }
+
+  // Fault the table in on load_threads threads, computing its checksum as
+  // they go unless it is not to be checked. Returns if it matched.
+  bool FaultIn() const {
+    SavedHeader sh;
+    memcpy(&sh, addr_, sizeof(sh));
+    const char *data = static_cast<const char *>(addr_) + sizeof(sh);
+    const bool check =
+        options_.verify_checksum && !(sh.flags_ & kTableCrcStale);
+    const size_t size = sh.data_size_;
+    const size_t num_chunks = (size + kLoadChunkSize - 1) / kLoadChunkSize;
+    std::vector<uint32_t> crcs(num_chunks);
+    ParallelFor(num_chunks, options_.load_threads, [&](size_t c) {
+      const char *chunk = data + c * kLoadChunkSize;
+      const size_t n = std::min(kLoadChunkSize, size - c * kLoadChunkSize);
+      if (check) {
+        crcs[c] = Crc32c(0, chunk, n);
+      } else {
+        uint32_t sum = 0;
+        for (size_t k = 0; k < n; k += 4096) {
+          sum += *reinterpret_cast<const volatile char *>(chunk + k);
+        }
+        crcs[c] = sum;
+      }
+    });
+    if (!check) {
+      return true;
+    }
+    uint32_t crc = 0;
+    for (size_t c = 0; c < num_chunks; c++) {
+      crc = Crc32cCombine(
+          crc, crcs[c], std::min(kLoadChunkSize, size - c * kLoadChunkSize));
+    }
+    return crc == sh.data_crc_;
+  }
+
+  bool Map(const std::string &path) {
+    if (options_.writable && options_.huge_pages == kCopyToHugePages) {
+      errno = EINVAL;
+      return Fail("writable with kCopyToHugePages");
+    }
+    int fd = open(path.c_str(), options_.writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+      return Fail("open " + path);
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 || Fail("fstat " + path);
+    length_ = ok ? st.st_size : 0;
+    if (ok && length_ == 0) {
+      errno = EINVAL;
+      ok = Fail(path);
+    }
+    if (ok) {
+      ok = options_.huge_pages == kCopyToHugePages ? CopyFile(fd) : MapFile(fd);
+    }
+    close(fd);
+    if (ok && options_.lock && mlock(addr_, map_length_) != 0) {
+      ok = Fail("mlock");
+    }
+    return ok;
+  }
+
+ public:
+  explicit MappedCuckooFilter(const std::string &path,
+                              const MapOptions &options = MapOptions())
+      : options_(options),
+        addr_(nullptr),
+        length_(0),
+        map_length_(0),
+        copied_(false),
+        modified_(false) {
+    const bool background = options_.background && !Copy();
+    if (Map(path)) {
+      const SavedHeader *sh = static_cast<const SavedHeader *>(addr_);
+      if (length_ >= sizeof(*sh) && (sh->flags_ & kCompressed)) {
+        error_ = path + " is compressed; load it with CuckooFilter";
+      } else {
+        this->Load(addr_, length_, options_.verify_checksum && !background);
+      }
+      if (!this->Valid() && error_.empty()) {
+        error_ = path + " is not a valid filter of this type";
+      }
+    }
+    if (background && this->Valid()) {
+      ready_ = std::async(std::launch::async, [this] { return FaultIn(); });
+    } else {
+      std::promise<bool> ready;
+      ready.set_value(this->Valid());
+      ready_ = ready.get_future().share();
+    }
+  }
+
+  ~MappedCuckooFilter() {
+    // The background threads read the mapping
+    ready_.wait();
+    if (modified_) {
+      Sync(true);
+    }
+    // The table points into the mapping
+    delete this->table_;
+    this->table_ = nullptr;
+    if (addr_) {
+      munmap(addr_, map_length_);
+    }
+  }
+
+  // Add an item to the filter, if it is writable or a copy
+  Status Add(const ItemType &item) {
+    if (copied_) {
+      return Filter::Add(item);
+    }
+    if (!options_.writable) {
+      return NotSupported;
+    }
+    Status status = Filter::Add(item);
+    WriteHeader(kTableCrcStale);
+    return status;
+  }
+
+  // Delete an key from the filter, if it is writable or a copy
+  Status Delete(const ItemType &item) {
+    if (copied_) {
+      return Filter::Delete(item);
+    }
+    if (!options_.writable) {
+      return NotSupported;
+    }
+    Status status = Filter::Delete(item);
+    WriteHeader(kTableCrcStale);
+    return status;
+  }
+
+  // Add every tag of other, as CuckooFilter::Merge does, if the filter is
+  // writable or a copy
+  Status Merge(const Filter &other, const size_t num_threads = 1) {
+    if (copied_) {
+      return Filter::Merge(other, num_threads);
+    }
+    if (!options_.writable) {
+      return NotSupported;
+    }
+    Status status = Filter::Merge(other, num_threads);
+    WriteHeader(kTableCrcStale);
+    return status;
+  }
+
+  // Delete every item of other, as CuckooFilter::Subtract does, if the
+  // filter is writable or a copy
+  Status Subtract(const Filter &other, const size_t num_threads = 1) {
+    if (copied_) {
+      return Filter::Subtract(other, num_threads);
+    }
+    if (!options_.writable) {
+      return NotSupported;
+    }
+    Status status = Filter::Subtract(other, num_threads);
+    WriteHeader(kTableCrcStale);
+    return status;
+  }
+
+  // Add n keys, as CuckooFilter::BulkBuild does, if the filter is writable
+  // or a copy
+  Status BulkBuild(const ItemType *keys, const size_t n,
+                   const size_t num_threads = 1) {
+    if (copied_) {
+      return Filter::BulkBuild(keys, n, num_threads);
+    }
+    if (!options_.writable) {
+      return NotSupported;
+    }
+    Status status = Filter::BulkBuild(keys, n, num_threads);
+    WriteHeader(kTableCrcStale);
+    return status;
+  }
+
+  // Patch the filter with a delta, if it is writable or a copy; a writable
+  // filter's file is patched in place, and Sync writes back only the pages
+  // of the ranges patched
+  Status ApplyDelta(const void *addr, const size_t length) {
+    if (copied_) {
+      return Filter::ApplyDelta(addr, length);
+    }
+    if (!options_.writable) {
+      return NotSupported;
+    }
+    Status status = Filter::ApplyDelta(addr, length);
+    if (status == Ok) {
+      WriteHeader(kTableCrcStale);
+    }
+    return status;
+  }
+
+  Status ApplyDelta(const std::string &path) {
+    std::vector<char> buf;
+    if (!Filter::ReadWholeFile(path, &buf)) {
+      return NotSupported;
+    }
+    return ApplyDelta(buf.data(), buf.size());
+  }
+
+  // Write the changes made to a writable filter back to the file, and wait
+  // for them to reach it. With checksum, the table checksum is computed
+  // again first, so the file can be fully checked when loaded. Returns
+  // false if the filter is not writable or the write back fails.
+  bool Sync(const bool checksum = false) {
+    if (!options_.writable || !this->Valid()) {
+      return false;
+    }
+    if (checksum || modified_) {
+      WriteHeader(checksum ? 0 : kTableCrcStale);
+    }
+    if (msync(addr_, map_length_, MS_SYNC) != 0) {
+      return Fail("msync");
+    }
+    return true;
+  }
+
+  // why the filter is not Valid(), or empty if it is
+  const std::string &Error() const { return error_; }
+
+  // Becomes ready once the filter is loaded: with options.background, when
+  // its table is resident, and is true if the table matched its checksum
+  // or was not to be checked. Without it, it is ready at once and true if
+  // the filter is Valid(). A filter must not be modified before then.
+  std::shared_future<bool> Ready() const { return ready_; }
+
+  /* methods for providing stats  */
+  // summary infomation
+  std::string Info() const {
+    std::stringstream ss;
+    ss << Filter::Info() << "\t\tMapping: " << map_length_ << " bytes of "
+       << (copied_ ? "anonymous memory" : "the file")
+       << (options_.writable ? ", writable" : "")
+       << (options_.huge_pages != kNoHugePages ? ", huge pages" : "")
+       << (options_.lock ? ", locked" : "") << "\n";
+    return ss.str();
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_MAPPED_CUCKOO_FILTER_H_
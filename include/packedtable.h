@@ -0,0 +1,265 @@
+#ifndef CUCKOO_FILTER_PACKED_TABLE_H_
+#define CUCKOO_FILTER_PACKED_TABLE_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <sstream>
+#include <string.h> // for memset
+
+#include "bitsutil.h"
+#include "permencoding.h"
+#include "simdutil.h"
+
+namespace cuckoofilter {
+
+// A table that uses semi-sorting to save 1 bit per tag: the tags of a bucket
+// are kept sorted by their low 4 bits, and the four sorted low bit values are
+// stored as one 12 bit PermEncoding codeword instead of 16 bits. The rest of
+// each tag, its "dir" bits, is stored as is. A bucket of bits_per_tag bit
+// tags thus takes 4 * (bits_per_tag - 1) bits:
+//
+//   | dir[3] | dir[2] | dir[1] | dir[0] | codeword (12 bits) |
+//
+// Buckets are packed back to back, so a bucket may start in the middle of a
+// byte. Slot positions are not stable: writing a tag re-sorts its bucket.
+//
+// Use it as CuckooFilter<ItemType, bits_per_item, PackedTable>.
+template <size_t bits_per_tag>
+class PackedTable {
+  static_assert(bits_per_tag >= 5 && bits_per_tag <= 17,
+                "PackedTable supports 5 to 17 bits per tag");
+
+ public:
+  static const size_t kTagsPerBucket = 4;
+  // names the table in saved filters
+  static const uint32_t kFormatId = 2;
+  // writing a tag re-sorts its bucket
+  static const bool kStableSlots = false;
+
+ private:
+  static const size_t kDirBitsPerTag = bits_per_tag - 4;
+  static const size_t kBitsPerBucket =
+      PermEncoding::kBitsPerCodeword + kDirBitsPerTag * kTagsPerBucket;
+  static const uint64_t kBucketMask =
+      kBitsPerBucket == 64 ? ~0ULL : (1ULL << (kBitsPerBucket % 64)) - 1;
+  static const uint32_t kDirBitsMask = (1ULL << kDirBitsPerTag) - 1;
+  static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
+  // NOTE: buckets are read and written as a uint64 starting at the bucket's
+  // first byte, which runs past the last bucket
+  static const size_t kPaddingBytes = 8;
+
+  char *buckets_ = nullptr;
+  size_t num_buckets_ = 0;
+  bool own_mem_ = true;
+
+  // A bucket starts at bit i * kBitsPerBucket, which is a multiple of 4; the
+  // uint64 read at its first byte holds the whole bucket once shifted
+  inline char *BucketPtr(const size_t i) const {
+    return buckets_ + ((i * kBitsPerBucket) >> 3);
+  }
+
+  inline size_t BucketShift(const size_t i) const {
+    return (i * kBitsPerBucket) & 7;
+  }
+
+  // read the tags of bucket i, sorted by their low 4 bits
+  inline void ReadBucket(const size_t i, uint32_t tags[4]) const {
+    uint64_t v;
+    memcpy(&v, BucketPtr(i), sizeof(v));
+    v = (v >> BucketShift(i)) & kBucketMask;
+
+    uint8_t lowbits[4];
+    PermEncoding::Get().Decode(v & ((1 << PermEncoding::kBitsPerCodeword) - 1),
+                               lowbits);
+    v >>= PermEncoding::kBitsPerCodeword;
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      tags[j] = ((v & kDirBitsMask) << 4) | lowbits[j];
+      v >>= kDirBitsPerTag;
+    }
+  }
+
+  // write the tags of bucket i, in any order
+  inline void WriteBucket(const size_t i, uint32_t tags[4]) {
+    // Sort by the low bits the codeword encodes; ties by the whole tag, so a
+    // set of tags always has the same encoding
+    std::sort(tags, tags + kTagsPerBucket, [](uint32_t a, uint32_t b) {
+      return ((a & 0x0f) << 28 | a >> 4) < ((b & 0x0f) << 28 | b >> 4);
+    });
+
+    uint8_t lowbits[4];
+    uint64_t dirs = 0;
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      lowbits[j] = tags[j] & 0x0f;
+      dirs |= (uint64_t)((tags[j] >> 4) & kDirBitsMask) << (j * kDirBitsPerTag);
+    }
+    uint64_t bucket =
+        (dirs << PermEncoding::kBitsPerCodeword) | PermEncoding::Get().Encode(lowbits);
+
+    char *p = BucketPtr(i);
+    const size_t shift = BucketShift(i);
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    v = (v & ~(kBucketMask << shift)) | (bucket << shift);
+    memcpy(p, &v, sizeof(v));
+  }
+
+ public:
+  explicit PackedTable(const size_t num) : num_buckets_(num) {
+    buckets_ = new char[SizeInBytes()];
+    memset(buckets_, 0, SizeInBytes());
+    own_mem_ = true;
+  }
+
+  explicit PackedTable(void *addr, size_t length) {
+    // We were given the memory area to use. Set the buckets pointer and
+    // calculate the number of buckets
+    buckets_ = static_cast<char *>(addr);
+    num_buckets_ = ((length - kPaddingBytes) << 3) / kBitsPerBucket;
+    own_mem_ = false;
+  }
+
+  ~PackedTable() {
+    if (own_mem_) {
+      delete[] buckets_;
+    }
+  }
+
+  size_t NumBuckets() const {
+    return num_buckets_;
+  }
+
+  size_t SizeInBytes() const {
+    return ((kBitsPerBucket * num_buckets_ + 7) >> 3) + kPaddingBytes;
+  }
+
+  size_t SizeInTags() const {
+    return kTagsPerBucket * num_buckets_;
+  }
+
+  // raw data of the filter
+  const unsigned char * Data() const {
+    return (unsigned char *)buckets_;
+  }
+
+  unsigned char * Data() {
+    return (unsigned char *)buckets_;
+  }
+
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "PackedHashtable with tag size: " << bits_per_tag << " bits \n";
+    ss << "\t\t4 packed bits(3 bits after compression) and "
+       << kDirBitsPerTag << " direct bits\n";
+    ss << "\t\tAssociativity: " << kTagsPerBucket << "\n";
+    ss << "\t\tTotal # of rows: " << num_buckets_ << "\n";
+    ss << "\t\tTotal # slots: " << SizeInTags() << "\n";
+    return ss.str();
+  }
+
+  // Are buckets [begin, end), begin < end, all empty; an empty bucket is
+  // all zero bits, so they are checked a vector at a time
+  inline bool BucketsEmpty(const size_t begin, const size_t end) const {
+    // the bytes may hold bits of the buckets on either side, which only
+    // makes the answer conservative
+    const size_t first = (begin * kBitsPerBucket) >> 3;
+    const size_t last = (end * kBitsPerBucket + 7) >> 3;
+    return AllZero(buckets_ + first, last - first);
+  }
+
+  // Start loading bucket i into the cache ahead of a FindTagInBuckets call
+  inline void PrefetchBucket(const size_t i) const {
+    const char *p = BucketPtr(i);
+    __builtin_prefetch(p);
+    __builtin_prefetch(p + sizeof(uint64_t) - 1);
+  }
+
+  // read tag from pos(i,j)
+  inline uint32_t ReadTag(const size_t i, const size_t j) const {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    return tags[j];
+  }
+
+  // write tag to pos(i,j); this re-sorts the bucket, moving the other tags
+  inline void WriteTag(const size_t i, const size_t j, const uint32_t t) {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    tags[j] = t & kTagMask;
+    WriteBucket(i, tags);
+  }
+
+  inline bool FindTagInBuckets(const size_t i1, const size_t i2,
+                               const uint32_t tag) const {
+    uint32_t tags1[4];
+    uint32_t tags2[4];
+    ReadBucket(i1, tags1);
+    ReadBucket(i2, tags2);
+    return (tags1[0] == tag) || (tags1[1] == tag) || (tags1[2] == tag) ||
+           (tags1[3] == tag) || (tags2[0] == tag) || (tags2[1] == tag) ||
+           (tags2[2] == tag) || (tags2[3] == tag);
+  }
+
+  // FindTagInBuckets for n keys at once
+  inline void FindTagInBucketsBatch(const size_t *i1, const size_t *i2,
+                                    const uint32_t *tags, const size_t n,
+                                    uint8_t *found) const {
+    for (size_t k = 0; k < n; k++) {
+      found[k] = FindTagInBuckets(i1[k], i2[k], tags[k]);
+    }
+  }
+
+  inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    return (tags[0] == tag) || (tags[1] == tag) || (tags[2] == tag) ||
+           (tags[3] == tag);
+  }
+
+  inline bool DeleteTagFromBucket(const size_t i, const uint32_t tag) {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (tags[j] == tag) {
+        tags[j] = 0;
+        WriteBucket(i, tags);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline bool InsertTagToBucket(const size_t i, const uint32_t tag,
+                                const bool kickout, uint32_t &oldtag) {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (tags[j] == 0) {
+        tags[j] = tag;
+        WriteBucket(i, tags);
+        return true;
+      }
+    }
+    if (kickout) {
+      size_t r = rand() % kTagsPerBucket;
+      oldtag = tags[r];
+      tags[r] = tag;
+      WriteBucket(i, tags);
+    }
+    return false;
+  }
+
+  inline size_t NumTagsInBucket(const size_t i) const {
+    uint32_t tags[4];
+    ReadBucket(i, tags);
+    size_t num = 0;
+    for (size_t j = 0; j < kTagsPerBucket; j++) {
+      if (tags[j] != 0) {
+        num++;
+      }
+    }
+    return num;
+  }
+};
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_PACKED_TABLE_H_
@@ -0,0 +1,66 @@
+#ifndef CUCKOO_FILTER_PARALLEL_BUILD_H_
+#define CUCKOO_FILTER_PARALLEL_BUILD_H_
+
+#include <memory>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "threadutil.h"
+
+namespace cuckoofilter {
+
+// Build a filter for max_num_keys keys, seeded with seed, that holds the n
+// keys at keys, on num_threads threads. FilterType is a CuckooFilter.
+//
+// The keys are split into num_threads runs, and each thread adds its run to
+// a shard filter of the same size and seed; as the shards hash alike, each
+// one is then merged into the first, bucket by bucket on all the threads.
+// Hashing and most of the table writes are done in parallel, at the cost of
+// memory for num_threads filters while building.
+//
+// The filter is the same for the same keys, seed and num_threads. Returns
+// null if a filter cannot be allocated; status, if given, is set to Ok if
+// every key was added and NotEnoughSpace if not.
+template <typename FilterType, typename ItemType>
+std::unique_ptr<FilterType> ParallelBuild(const ItemType *keys, const size_t n,
+                                          const size_t max_num_keys,
+                                          const uint64_t seed,
+                                          size_t num_threads,
+                                          Status *status = nullptr) {
+  num_threads = std::max<size_t>(1, num_threads);
+  std::vector<std::unique_ptr<FilterType>> shards(num_threads);
+  for (std::unique_ptr<FilterType> &shard : shards) {
+    shard.reset(new (std::nothrow) FilterType(max_num_keys, seed));
+    if (!shard || !shard->Valid()) {
+      return nullptr;
+    }
+  }
+
+  std::vector<Status> results(num_threads, Ok);
+  ParallelFor(num_threads, num_threads, [&](size_t t) {
+    for (size_t k = n * t / num_threads; k < n * (t + 1) / num_threads; k++) {
+      if (shards[t]->Add(keys[k]) != Ok) {
+        results[t] = NotEnoughSpace;
+      }
+    }
+  });
+  for (size_t t = 1; t < num_threads; t++) {
+    if (shards[0]->Merge(*shards[t], num_threads) != Ok) {
+      results[t] = NotEnoughSpace;
+    }
+    shards[t].reset();
+  }
+
+  if (status) {
+    *status = Ok;
+    for (Status result : results) {
+      if (result != Ok) {
+        *status = result;
+      }
+    }
+  }
+  return std::move(shards[0]);
+}
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_PARALLEL_BUILD_H_
@@ -0,0 +1,74 @@
+#ifndef CUCKOO_FILTER_PERM_ENCODING_H_
+#define CUCKOO_FILTER_PERM_ENCODING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cuckoofilter {
+
+// Encodes a sorted sequence of four 4-bit values as its index among all such
+// sequences. There are only C(16 + 4 - 1, 4) = 3876 of them, so the index fits
+// in 12 bits instead of 16: the 1 bit per tag semi-sorting saves.
+class PermEncoding {
+  // unpack one 2-byte number to four 4-bit numbers
+  inline void unpack(const uint16_t in, uint8_t out[4]) const {
+    out[0] = (in & 0x000f);
+    out[1] = ((in >> 4) & 0x000f);
+    out[2] = ((in >> 8) & 0x000f);
+    out[3] = ((in >> 12) & 0x000f);
+  }
+
+  // pack four 4-bit numbers to one 2-byte number
+  inline uint16_t pack(const uint8_t in[4]) const {
+    return (in[0] & 0x000f) | ((in[1] << 4) & 0x00f0) |
+           ((in[2] << 8) & 0x0f00) | ((in[3] << 12) & 0xf000);
+  }
+
+  // enumerate the sorted sequences in lexicographic order; the one of all
+  // zeros, an empty bucket, gets codeword 0
+  void GenTables(const uint8_t base, const size_t k, uint8_t dst[4],
+                 uint16_t &idx) {
+    for (uint8_t i = base; i < 16; i++) {
+      dst[k] = i;
+      if (k + 1 < 4) {
+        GenTables(i, k + 1, dst, idx);
+      } else {
+        dec_table_[idx] = pack(dst);
+        enc_table_[pack(dst)] = idx;
+        idx++;
+      }
+    }
+  }
+
+  uint16_t dec_table_[3876];
+  uint16_t enc_table_[1 << 16];
+
+ public:
+  static const size_t kNumEntries = 3876;
+  static const size_t kBitsPerCodeword = 12;
+
+  PermEncoding() {
+    uint8_t dst[4];
+    uint16_t idx = 0;
+    GenTables(0, 0, dst, idx);
+  }
+
+  // The tables are 136KB and the same for every table, so they are built
+  // once and shared
+  static const PermEncoding &Get() {
+    static const PermEncoding perm;
+    return perm;
+  }
+
+  inline void Decode(const uint16_t codeword, uint8_t lowbits[4]) const {
+    unpack(dec_table_[codeword], lowbits);
+  }
+
+  // lowbits must be sorted in ascending order
+  inline uint16_t Encode(const uint8_t lowbits[4]) const {
+    return enc_table_[pack(lowbits)];
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_PERM_ENCODING_H_
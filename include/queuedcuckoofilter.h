@@ -0,0 +1,483 @@
+#ifndef CUCKOO_FILTER_QUEUED_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_QUEUED_CUCKOO_FILTER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "concurrentcuckoofilter.h"
+
+namespace cuckoofilter {
+
+// Options of a QueuedCuckooFilter
+struct QueueOptions {
+  // number of shards, each updated by an applier thread of its own
+  size_t num_appliers = 1;
+
+  // number of updates a producer can have queued for one shard; a power of
+  // two, or rounded up to one. A producer that fills its queue waits for
+  // the applier.
+  size_t queue_capacity = 1 << 12;
+
+  // most updates an applier takes from the queues at a time and applies
+  // under one lock
+  size_t max_batch = 1 << 16;
+
+  // how long an idle applier sleeps before it looks at the queues again,
+  // and so about the longest an update waits to be readable when nobody
+  // calls Flush
+  uint32_t max_delay_us = 1000;
+};
+
+// A cuckoo filter that takes updates from many threads without making them
+// contend. Each producer thread makes a Producer, whose Add and Delete hash
+// the key and push it onto a single producer, single consumer ring of its
+// own, one per shard; they do not lock and do not wait unless the ring is
+// full. Each shard has an applier thread that drains the rings of all the
+// producers in batches, orders a batch by bucket, so that the writes of
+// its inserts and deletes walk the table in order instead of at random,
+// and applies it under one lock.
+//
+// Updates are applied some time after they are queued: Producer::Flush
+// waits until those of one producer are, and Flush until all those queued
+// before it are. Until then, Contain may not see them. The updates of one
+// producer are applied in order; those of different producers in any
+// order. Since they are applied later, an Add that finds its shard full or
+// a Delete of a key that is not there cannot report it, and is counted by
+// Failures instead.
+//
+// Shards are ConcurrentCuckooFilters, so Contain and ContainBatch never
+// lock and may run on any thread while the appliers write.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class QueuedCuckooFilter {
+  typedef ConcurrentCuckooFilter<ItemType, bits_per_item, TableType,
+                                 HashFamily>
+      Filter;
+
+  enum Op : uint32_t { kAdd, kDelete };
+
+  // number of keys ContainBatch routes before probing their shards
+  static const size_t kBatchSize = 256;
+
+  // An update, hashed by its producer
+  struct Update {
+    uint32_t index;
+    uint32_t tag;
+    uint32_t op;
+  };
+
+  // A ring of updates from one producer to one applier. head is written by
+  // the producer only, tail and applied by the applier only, and each side
+  // has a cache line of its own. Updates [tail, head) are queued and those
+  // before applied are in the table.
+  struct Queue {
+    char padding0[64];
+    std::atomic<size_t> head;
+    // the producer's last look at tail
+    size_t cached_tail;
+    char padding1[64];
+    std::atomic<size_t> tail;
+    std::atomic<size_t> applied;
+    char padding2[64];
+    std::unique_ptr<Update[]> updates;
+    // owned by a Producer; guarded by the mutex of the shard
+    bool in_use;
+  };
+
+  // A shard, with access to the hashing and the locked updates of its
+  // filter
+  class ShardFilter : public Filter {
+   public:
+    explicit ShardFilter(const size_t max_num_keys) : Filter(max_num_keys) {}
+
+    void Hash(const ItemType &item, Update *update) const {
+      size_t index;
+      this->GenerateIndexTagHash(item, &index, &update->tag);
+      update->index = index;
+    }
+
+    // Apply the n updates at batch in order of bucket, under one lock, and
+    // return how many failed. order and count are scratch space.
+    size_t Apply(const Update *batch, const size_t n,
+                 std::vector<uint32_t> *order, std::vector<uint32_t> *count) {
+      // A stable counting sort by the high bits of the bucket index, with
+      // about as many groups as updates, so that the updates of a key stay
+      // in the order they were queued
+      const int bucket_bits = __builtin_ctzll(this->table_->NumBuckets());
+      int group_bits = 0;
+      while (group_bits < bucket_bits && (size_t(1) << group_bits) < n) {
+        group_bits++;
+      }
+      const int shift = bucket_bits - group_bits;
+      count->assign((size_t(1) << group_bits) + 1, 0);
+      for (size_t k = 0; k < n; k++) {
+        (*count)[(batch[k].index >> shift) + 1]++;
+      }
+      for (size_t g = 1; g < count->size(); g++) {
+        (*count)[g] += (*count)[g - 1];
+      }
+      order->resize(n);
+      for (size_t k = 0; k < n; k++) {
+        (*order)[(*count)[batch[k].index >> shift]++] = k;
+      }
+
+      size_t failures = 0;
+      std::lock_guard<std::mutex> lock(this->write_mutex_);
+      for (size_t k = 0; k < n; k++) {
+        const Update &update = batch[(*order)[k]];
+        const size_t i2 = this->AltIndex(update.index, update.tag);
+        Status status =
+            update.op == kAdd
+                ? this->AddTagLocked(update.index, i2, update.tag)
+                : this->DeleteTagLocked(update.index, i2, update.tag);
+        failures += (status != Ok);
+      }
+      return failures;
+    }
+  };
+
+  // A shard is allocated on its own and padded past a cache line, so that
+  // the fields of two shards never share one
+  struct Shard {
+    std::unique_ptr<ShardFilter> filter;
+    // guards queues, wake and stop, and the waits on the condition variables
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Queue>> queues;
+    // the applier waits on wake_cv for wake, Flush on applied_cv
+    std::condition_variable wake_cv;
+    std::condition_variable applied_cv;
+    bool wake;
+    bool stop;
+    std::atomic<size_t> failures;
+    std::thread applier;
+    char padding[64];
+  };
+
+  QueueOptions options_;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  HashFamily router_;
+
+  inline size_t ShardIndex(const ItemType &item) const {
+    if (shards_.size() == 1) {
+      return 0;
+    }
+    return ((router_(item) >> 32) * shards_.size()) >> 32;
+  }
+
+  // A free queue of shard, made if there is none; shard.mutex must be held
+  Queue *TakeQueue(Shard &shard) {
+    for (const std::unique_ptr<Queue> &queue : shard.queues) {
+      if (!queue->in_use) {
+        queue->in_use = true;
+        return queue.get();
+      }
+    }
+    Queue *queue = new Queue;
+    queue->head.store(0, std::memory_order_relaxed);
+    queue->cached_tail = 0;
+    queue->tail.store(0, std::memory_order_relaxed);
+    queue->applied.store(0, std::memory_order_relaxed);
+    queue->updates.reset(new Update[options_.queue_capacity]);
+    queue->in_use = true;
+    shard.queues.emplace_back(queue);
+    return queue;
+  }
+
+  // Wake the applier of shard, if it sleeps
+  void Wake(Shard &shard) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.wake = true;
+    shard.wake_cv.notify_one();
+  }
+
+  // Wait until the updates of queue before target are applied
+  void WaitApplied(Shard &shard, const Queue &queue, const size_t target) {
+    if (queue.applied.load(std::memory_order_acquire) >= target) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.wake = true;
+    shard.wake_cv.notify_one();
+    shard.applied_cv.wait(lock, [&queue, target] {
+      return queue.applied.load(std::memory_order_acquire) >= target;
+    });
+  }
+
+  // The loop of the applier of shard, until the destructor stops it and the
+  // queues are empty
+  void RunApplier(Shard *shard) {
+    std::vector<Update> batch;
+    std::vector<std::pair<Queue *, size_t>> drained;
+    std::vector<uint32_t> order, count;
+    // the queue to drain first, moved on each time so that a full batch
+    // does not always leave the same queues out
+    size_t first = 0;
+    for (;;) {
+      batch.clear();
+      drained.clear();
+      {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        const size_t num_queues = shard->queues.size();
+        for (size_t q = 0; q < num_queues; q++) {
+          Queue *queue = shard->queues[(first + q) % num_queues].get();
+          const size_t head = queue->head.load(std::memory_order_acquire);
+          const size_t tail = queue->tail.load(std::memory_order_relaxed);
+          const size_t n =
+              std::min(head - tail, options_.max_batch - batch.size());
+          if (n == 0) {
+            continue;
+          }
+          for (size_t k = tail; k < tail + n; k++) {
+            batch.push_back(
+                queue->updates[k & (options_.queue_capacity - 1)]);
+          }
+          queue->tail.store(tail + n, std::memory_order_release);
+          drained.emplace_back(queue, tail + n);
+          if (batch.size() == options_.max_batch) {
+            break;
+          }
+        }
+        first++;
+        if (batch.empty()) {
+          if (shard->stop) {
+            return;
+          }
+          shard->wake_cv.wait_for(
+              lock, std::chrono::microseconds(options_.max_delay_us),
+              [shard] { return shard->wake; });
+          shard->wake = false;
+          continue;
+        }
+      }
+
+      shard->failures.fetch_add(
+          shard->filter->Apply(batch.data(), batch.size(), &order, &count),
+          std::memory_order_relaxed);
+      for (const std::pair<Queue *, size_t> &d : drained) {
+        d.first->applied.store(d.second, std::memory_order_release);
+      }
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->applied_cv.notify_all();
+    }
+  }
+
+ public:
+  // The updates of one thread. A Producer must only be used by one thread
+  // at a time, and must be destroyed before its filter; its destructor
+  // waits until its updates are applied.
+  class Producer {
+    QueuedCuckooFilter *filter_;
+    // queues_[s] is our queue to shard s
+    std::vector<Queue *> queues_;
+
+    void Push(const size_t s, const Update &update) {
+      Queue &queue = *queues_[s];
+      const size_t capacity = filter_->options_.queue_capacity;
+      const size_t head = queue.head.load(std::memory_order_relaxed);
+      if (head - queue.cached_tail == capacity) {
+        queue.cached_tail = queue.tail.load(std::memory_order_acquire);
+        if (head - queue.cached_tail == capacity) {
+          filter_->Wake(*filter_->shards_[s]);
+          do {
+            std::this_thread::yield();
+            queue.cached_tail = queue.tail.load(std::memory_order_acquire);
+          } while (head - queue.cached_tail == capacity);
+        }
+      }
+      queue.updates[head & (capacity - 1)] = update;
+      queue.head.store(head + 1, std::memory_order_release);
+    }
+
+    void Enqueue(const ItemType &item, const Op op) {
+      const size_t s = filter_->ShardIndex(item);
+      Update update;
+      filter_->shards_[s]->filter->Hash(item, &update);
+      update.op = op;
+      Push(s, update);
+    }
+
+   public:
+    explicit Producer(QueuedCuckooFilter *filter) : filter_(filter) {
+      for (const std::unique_ptr<Shard> &shard : filter_->shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        queues_.push_back(filter_->TakeQueue(*shard));
+      }
+    }
+
+    Producer(const Producer &) = delete;
+    Producer &operator=(const Producer &) = delete;
+
+    ~Producer() {
+      Flush();
+      for (size_t s = 0; s < queues_.size(); s++) {
+        std::lock_guard<std::mutex> lock(filter_->shards_[s]->mutex);
+        queues_[s]->in_use = false;
+      }
+    }
+
+    // Queue an add of item
+    void Add(const ItemType &item) { Enqueue(item, kAdd); }
+
+    // Queue a delete of item
+    void Delete(const ItemType &item) { Enqueue(item, kDelete); }
+
+    // Wait until every update queued so far is applied and readable
+    void Flush() {
+      for (size_t s = 0; s < queues_.size(); s++) {
+        filter_->WaitApplied(*filter_->shards_[s], *queues_[s],
+                             queues_[s]->head.load(std::memory_order_relaxed));
+      }
+    }
+  };
+
+  // Split a filter for max_num_keys keys into options.num_appliers shards,
+  // and start their appliers
+  explicit QueuedCuckooFilter(const size_t max_num_keys,
+                              const QueueOptions &options = QueueOptions())
+      : options_(options), router_() {
+    size_t capacity = 1;
+    while (capacity < options_.queue_capacity) {
+      capacity <<= 1;
+    }
+    options_.queue_capacity = capacity;
+    options_.max_batch = std::max<size_t>(1, options_.max_batch);
+    const size_t num_shards = std::max<size_t>(1, options_.num_appliers);
+    for (size_t s = 0; s < num_shards; s++) {
+      shards_.emplace_back(new Shard);
+      Shard &shard = *shards_[s];
+      shard.filter.reset(
+          new ShardFilter((max_num_keys + num_shards - 1) / num_shards));
+      shard.wake = false;
+      shard.stop = false;
+      shard.failures.store(0, std::memory_order_relaxed);
+    }
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      shard->applier = std::thread(&QueuedCuckooFilter::RunApplier, this,
+                                   shard.get());
+    }
+  }
+
+  QueuedCuckooFilter(const QueuedCuckooFilter &) = delete;
+  QueuedCuckooFilter &operator=(const QueuedCuckooFilter &) = delete;
+
+  // Apply what is queued and stop the appliers
+  ~QueuedCuckooFilter() {
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->stop = true;
+      shard->wake = true;
+      shard->wake_cv.notify_one();
+    }
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      shard->applier.join();
+    }
+  }
+
+  // Wait until every update queued before the call, by any producer, is
+  // applied and readable
+  void Flush() {
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      std::vector<std::pair<const Queue *, size_t>> targets;
+      {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (const std::unique_ptr<Queue> &queue : shard->queues) {
+          targets.emplace_back(queue.get(),
+                               queue->head.load(std::memory_order_acquire));
+        }
+      }
+      for (const std::pair<const Queue *, size_t> &target : targets) {
+        WaitApplied(*shard, *target.first, target.second);
+      }
+    }
+  }
+
+  // Report if the item is inserted, with false positive rate; updates not
+  // applied yet may not be seen.
+  Status Contain(const ItemType &item) const {
+    return shards_[ShardIndex(item)]->filter->Contain(item);
+  }
+
+  // Report for each of the n keys if it is inserted. The keys are grouped
+  // by shard, a batch at a time, and each group probed with ContainBatch.
+  void ContainBatch(const ItemType *keys, size_t n, uint8_t *results) const {
+    const size_t num_shards = shards_.size();
+    if (num_shards == 1) {
+      shards_[0]->filter->ContainBatch(keys, n, results);
+      return;
+    }
+    std::vector<size_t> shard_of(kBatchSize), begin(num_shards + 1);
+    std::vector<size_t> position(kBatchSize);
+    std::vector<ItemType> grouped(kBatchSize);
+    std::vector<uint8_t> status(kBatchSize);
+    for (size_t base = 0; base < n; base += kBatchSize) {
+      const size_t count = std::min(kBatchSize, n - base);
+      std::fill(begin.begin(), begin.end(), 0);
+      for (size_t k = 0; k < count; k++) {
+        shard_of[k] = ShardIndex(keys[base + k]);
+        begin[shard_of[k] + 1]++;
+      }
+      for (size_t s = 0; s < num_shards; s++) {
+        begin[s + 1] += begin[s];
+      }
+      std::vector<size_t> next(begin.begin(), begin.end() - 1);
+      for (size_t k = 0; k < count; k++) {
+        const size_t g = next[shard_of[k]]++;
+        grouped[g] = keys[base + k];
+        position[g] = base + k;
+      }
+      for (size_t s = 0; s < num_shards; s++) {
+        if (begin[s] == begin[s + 1]) {
+          continue;
+        }
+        shards_[s]->filter->ContainBatch(&grouped[begin[s]],
+                                         begin[s + 1] - begin[s],
+                                         &status[begin[s]]);
+      }
+      for (size_t g = 0; g < count; g++) {
+        results[position[g]] = status[g];
+      }
+    }
+  }
+
+  // number of updates applied that failed: adds to a full shard and deletes
+  // of keys that were not there
+  size_t Failures() const {
+    size_t failures = 0;
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      failures += shard->failures.load(std::memory_order_relaxed);
+    }
+    return failures;
+  }
+
+  // number of inserted items applied so far
+  size_t Size() const {
+    size_t size = 0;
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      size += shard->filter->Size();
+    }
+    return size;
+  }
+
+  // size of the filter in bytes, without the queues
+  size_t SizeInBytes() const {
+    size_t size = 0;
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      size += shard->filter->SizeInBytes();
+    }
+    return size;
+  }
+
+  // number of shards, and of applier threads
+  size_t NumShards() const { return shards_.size(); }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_QUEUED_CUCKOO_FILTER_H_
@@ -0,0 +1,441 @@
+#ifndef CUCKOO_FILTER_RESIZABLE_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_RESIZABLE_CUCKOO_FILTER_H_
+
+#include <fstream>
+#include <sstream>
+
+#include "cuckoofilter.h"
+
+namespace cuckoofilter {
+
+// The header ResizableCuckooFilter::Save writes ahead of what CuckooFilter
+// writes for its table. Fixed width, little endian.
+const char kResizableFormatMagic[8] = {'C', 'U', 'C', 'K', 'O', 'O', 'R', 'Z'};
+const uint32_t kResizableFormatVersion = 1;
+
+struct ResizableHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t bits_per_item_;
+  uint64_t doublings_;
+  uint32_t max_doublings_;
+  uint32_t header_crc_;
+};
+
+// A cuckoo filter that can double its number of buckets up to max_doublings
+// times without the original keys.
+//
+// Doubling the table takes one more bit of each item's bucket index, which
+// a plain CuckooFilter does not keep. Here every stored tag reserves
+// max_doublings bits for them: a tag is the bits_per_item bit fingerprint of
+// its item, and above it the next index bits of the bucket it is in, as if
+// the table had already been doubled max_doublings times. A tag that moves
+// to its other bucket has those bits recomputed for it. Resize consumes the
+// lowest of them: it sends every tag to one of the two buckets its bucket
+// splits into and shifts the rest down, in one pass over the table.
+//
+// The reserved bits also tell apart the items of a bucket, so the false
+// positive rate starts out lower and rises to that of a CuckooFilter with
+// bits_per_item bit tags after the last doubling. The table stores tags of
+// bits_per_item + max_doublings bits and must have a Resize method, as
+// SingleTable does.
+//
+// The CuckooFilter is a private base: its Merge, Subtract, BulkBuild and
+// compressed and delta saves place tags without the reserved bits, so only
+// the members that do not are exported.
+template <typename ItemType, size_t bits_per_item, size_t max_doublings,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class ResizableCuckooFilter
+    : private CuckooFilter<ItemType, bits_per_item + max_doublings, TableType,
+                           HashFamily> {
+  static const size_t kBitsPerTag = bits_per_item + max_doublings;
+  static const uint32_t kFingerprintMask = (1ULL << bits_per_item) - 1;
+
+  typedef CuckooFilter<ItemType, kBitsPerTag, TableType, HashFamily> Filter;
+
+  // Number of times the table has been doubled
+  size_t doublings_;
+
+  inline size_t IndexBits() const {
+    return __builtin_ctzll(this->table_->NumBuckets());
+  }
+
+  // mask of a bucket index as if the table had been doubled max_doublings
+  // times
+  inline uint64_t FullIndexMask() const {
+    return ((uint64_t)this->table_->NumBuckets()
+            << (max_doublings - doublings_)) - 1;
+  }
+
+  // The bucket of a full index and the tag of fingerprint fp stored there
+  inline void Split(const uint64_t full_index, const uint32_t fp, size_t *i,
+                    uint32_t *tag) const {
+    *i = full_index & (this->table_->NumBuckets() - 1);
+    *tag = fp | (uint32_t)((full_index >> IndexBits()) << bits_per_item);
+  }
+
+  // The buckets of an item and the tags it is stored as in each
+  inline void GenerateIndexTags(const ItemType &item, size_t *i1, size_t *i2,
+                                uint32_t *tag1, uint32_t *tag2) const {
+    const uint64_t hash = this->hasher_(item);
+    uint32_t fp = hash & kFingerprintMask;
+    fp += (fp == 0);
+    // same as Filter::AltIndex, at the full index width
+    const uint64_t full1 = (hash >> 32) & FullIndexMask();
+    const uint64_t full2 = (full1 ^ (fp * 0x5bd1e995)) & FullIndexMask();
+    Split(full1, fp, i1, tag1);
+    Split(full2, fp, i2, tag2);
+  }
+
+  // The other bucket of a tag stored in bucket i, and the tag it is stored
+  // as there
+  inline void AltIndexTag(const size_t i, const uint32_t tag, size_t *alt,
+                          uint32_t *alttag) const {
+    const uint32_t fp = tag & kFingerprintMask;
+    const uint64_t full = i | ((uint64_t)(tag >> bits_per_item) << IndexBits());
+    Split((full ^ (fp * 0x5bd1e995)) & FullIndexMask(), fp, alt, alttag);
+  }
+
+  inline bool StashContains(const size_t i1, const size_t i2,
+                            const uint32_t tag1, const uint32_t tag2) const {
+    bool found = false;
+    for (size_t s = 0; s < this->stash_size_; s++) {
+      found |= (i1 == this->stash_[s].index && tag1 == this->stash_[s].tag) ||
+               (i2 == this->stash_[s].index && tag2 == this->stash_[s].tag);
+    }
+    return found;
+  }
+
+  // Move a stashed tag that now fits in one of its buckets into it; returns
+  // false if none does
+  bool Unstash() {
+    uint32_t oldtag;
+    for (size_t s = 0; s < this->stash_size_; s++) {
+      size_t alt;
+      uint32_t alttag;
+      AltIndexTag(this->stash_[s].index, this->stash_[s].tag, &alt, &alttag);
+      if (this->table_->InsertTagToBucket(this->stash_[s].index,
+                                          this->stash_[s].tag, false,
+                                          oldtag) ||
+          this->table_->InsertTagToBucket(alt, alttag, false, oldtag)) {
+        this->stash_[s] = this->stash_[--this->stash_size_];
+        this->stash_[this->stash_size_].used = false;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Store tag in bucket i or its other bucket, kicking tags on to theirs,
+  // and stash the last one kicked if no room turns up. The stash must have
+  // room.
+  void AddTag(size_t curindex, uint32_t curtag) {
+    uint32_t oldtag;
+    for (uint32_t count = 0; count < kMaxCuckooCount; count++) {
+      if (this->table_->InsertTagToBucket(curindex, curtag, false, oldtag)) {
+        this->num_items_++;
+        return;
+      }
+      if (count > 0) {
+        curtag = this->KickTag(curindex, curtag);
+      }
+      AltIndexTag(curindex, curtag, &curindex, &curtag);
+    }
+
+    typename Filter::VictimCache &victim = this->stash_[this->stash_size_++];
+    victim.index = curindex;
+    victim.tag = curtag;
+    victim.used = true;
+    this->num_items_++;
+  }
+
+  // Remove tag, stored in bucket i or as the matching tag of its other
+  // bucket; returns false if it is in neither
+  bool DeleteTag(const size_t i, const uint32_t tag) {
+    size_t alt;
+    uint32_t alttag;
+    AltIndexTag(i, tag, &alt, &alttag);
+
+    if (this->table_->DeleteTagFromBucket(i, tag) ||
+        this->table_->DeleteTagFromBucket(alt, alttag)) {
+      this->num_items_--;
+      if (this->stash_size_ != 0) {
+        Unstash();
+      }
+      return true;
+    }
+    if (this->stash_size_ != 0 && (this->StashRemove(i, i, tag) ||
+                                   this->StashRemove(alt, alt, alttag))) {
+      this->num_items_--;
+      return true;
+    }
+    return false;
+  }
+
+  // A tag of other means the same here only if both tables have been doubled
+  // to the same size from filters that hash alike
+  bool LaysOutLike(const ResizableCuckooFilter &other) const {
+    return doublings_ == other.doublings_ && this->HashesLike(other);
+  }
+
+  // Read the header saved at addr into doublings_; returns false if it is
+  // not one, or was saved by a filter of other template parameters
+  bool LoadHeader(const char *addr, size_t length) {
+    if (length < sizeof(ResizableHeader)) {
+      return false;
+    }
+    ResizableHeader sh;
+    memcpy(&sh, addr, sizeof(sh));
+    if (memcmp(sh.magic_, kResizableFormatMagic,
+               sizeof(kResizableFormatMagic)) != 0 ||
+        sh.version_ != kResizableFormatVersion ||
+        sh.header_crc_ !=
+            Crc32c(0, &sh, offsetof(ResizableHeader, header_crc_)) ||
+        sh.bits_per_item_ != bits_per_item ||
+        sh.max_doublings_ != max_doublings || sh.doublings_ > max_doublings) {
+      return false;
+    }
+    doublings_ = sh.doublings_;
+    return true;
+  }
+
+  void CheckIndexBits() {
+    // The bucket index comes from 32 bits of the hash
+    if (this->table_ && IndexBits() + max_doublings - doublings_ > 32) {
+      delete this->table_;
+      this->table_ = nullptr;
+    }
+  }
+
+ public:
+  explicit ResizableCuckooFilter(const size_t max_num_keys)
+      : Filter(max_num_keys), doublings_(0) {
+    CheckIndexBits();
+  }
+
+  // A filter whose hash functions are derived from seed; filters built with
+  // the same seed and size can be merged
+  ResizableCuckooFilter(const size_t max_num_keys, const uint64_t seed)
+      : Filter(max_num_keys, seed), doublings_(0) {
+    CheckIndexBits();
+  }
+
+  explicit ResizableCuckooFilter(void *addr, size_t length) : doublings_(0) {
+    // Load the filter from the specified buffer. We will not own the data we
+    // read in, so the caller better not free it...
+    if (!LoadHeader((const char *)addr, length)) {
+      return;
+    }
+    this->Load((char *)addr + sizeof(ResizableHeader),
+               length - sizeof(ResizableHeader));
+    CheckIndexBits();
+  }
+
+  explicit ResizableCuckooFilter(const std::string &path) : doublings_(0) {
+    // Read the saved filter from the specified path. We will own the data we
+    // read in and free it in the destructor.
+    size_t size = this->ReadFile(path);
+    if (!LoadHeader(this->readbuf_, size)) {
+      return;
+    }
+    this->Load(this->readbuf_ + sizeof(ResizableHeader),
+               size - sizeof(ResizableHeader));
+    CheckIndexBits();
+  }
+
+  // Add an item to the filter.
+  Status Add(const ItemType &item) {
+    if (this->stash_size_ == kStashSize) {
+      return NotEnoughSpace;
+    }
+
+    size_t i1, i2;
+    uint32_t tag1, tag2;
+    GenerateIndexTags(item, &i1, &i2, &tag1, &tag2);
+    AddTag(i1, tag1);
+    return Ok;
+  }
+
+  // Report if the item is inserted, with false positive rate.
+  Status Contain(const ItemType &item) const {
+    size_t i1, i2;
+    uint32_t tag1, tag2;
+    GenerateIndexTags(item, &i1, &i2, &tag1, &tag2);
+    if ((this->stash_size_ != 0 && StashContains(i1, i2, tag1, tag2)) ||
+        this->table_->FindTagInBucket(i1, tag1) ||
+        this->table_->FindTagInBucket(i2, tag2)) {
+      return Ok;
+    }
+    return NotFound;
+  }
+
+  // Report for each of the n keys if it is inserted, prefetching the buckets
+  // of a group of keys before probing them
+  void ContainBatch(const ItemType *keys, size_t n, uint8_t *results) const {
+    size_t i1[kContainBatchSize], i2[kContainBatchSize];
+    uint32_t tag1[kContainBatchSize], tag2[kContainBatchSize];
+
+    for (size_t base = 0; base < n; base += kContainBatchSize) {
+      const size_t count = std::min(kContainBatchSize, n - base);
+      for (size_t k = 0; k < count; k++) {
+        GenerateIndexTags(keys[base + k], &i1[k], &i2[k], &tag1[k], &tag2[k]);
+        this->table_->PrefetchBucket(i1[k]);
+        this->table_->PrefetchBucket(i2[k]);
+      }
+      for (size_t k = 0; k < count; k++) {
+        bool found = this->table_->FindTagInBucket(i1[k], tag1[k]) ||
+                     this->table_->FindTagInBucket(i2[k], tag2[k]) ||
+                     (this->stash_size_ != 0 &&
+                      StashContains(i1[k], i2[k], tag1[k], tag2[k]));
+        results[base + k] = found ? Ok : NotFound;
+      }
+    }
+  }
+
+  // Delete an key from the filter
+  Status Delete(const ItemType &item) {
+    size_t i1, i2;
+    uint32_t tag1, tag2;
+    GenerateIndexTags(item, &i1, &i2, &tag1, &tag2);
+    return DeleteTag(i1, tag1) ? Ok : NotFound;
+  }
+
+  // Add every item of other to this filter. Both must hash alike and have
+  // the same number of buckets and doublings; returns NotSupported if they
+  // do not, and NotEnoughSpace if the stash fills up part way.
+  Status Merge(const ResizableCuckooFilter &other) {
+    if (!LaysOutLike(other)) {
+      return NotSupported;
+    }
+    Status status = Ok;
+    Filter::ForEachTag(other, [&](size_t i, uint32_t tag) {
+      if (this->stash_size_ == kStashSize) {
+        status = NotEnoughSpace;
+      } else {
+        AddTag(i, tag);
+      }
+    });
+    return status;
+  }
+
+  // Remove every item of other from this filter, under the same conditions
+  // as Merge. Returns NotFound if some of them were not in it.
+  Status Subtract(const ResizableCuckooFilter &other) {
+    if (!LaysOutLike(other)) {
+      return NotSupported;
+    }
+    Status status = Ok;
+    Filter::ForEachTag(other, [&](size_t i, uint32_t tag) {
+      if (!DeleteTag(i, tag)) {
+        status = NotFound;
+      }
+    });
+    return status;
+  }
+
+  // Add n keys. The tags depend on the bucket they land in, so this is the
+  // same as Add on each key in turn.
+  Status BulkBuild(const ItemType *keys, const size_t n) {
+    for (size_t k = 0; k < n; k++) {
+      const Status status = Add(keys[k]);
+      if (status != Ok) {
+        return status;
+      }
+    }
+    return Ok;
+  }
+
+  // Double the number of buckets, in one pass over the table. Returns false,
+  // leaving the filter as it is, if it has been doubled max_doublings times
+  // already or there is not enough memory.
+  bool Resize() {
+    const size_t n = this->table_->NumBuckets();
+    if (doublings_ == max_doublings || !this->table_->Resize(2 * n)) {
+      return false;
+    }
+
+    // Bucket i splits into buckets i and i + n; the lowest reserved bit of
+    // each of its tags says which one the tag belongs in
+    const size_t kTagsPerBucket = Filter::kTagsPerBucket;
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < kTagsPerBucket; j++) {
+        uint32_t tag = this->table_->ReadTag(i, j);
+        if (tag == 0) {
+          continue;
+        }
+        uint32_t ext = tag >> bits_per_item;
+        uint32_t newtag = (tag & kFingerprintMask) | ((ext >> 1) << bits_per_item);
+        if (ext & 1) {
+          this->table_->WriteTag(i, j, 0);
+          this->table_->WriteTag(i + n, j, newtag);
+        } else {
+          this->table_->WriteTag(i, j, newtag);
+        }
+      }
+    }
+    for (size_t s = 0; s < this->stash_size_; s++) {
+      typename Filter::VictimCache &victim = this->stash_[s];
+      uint32_t ext = victim.tag >> bits_per_item;
+      victim.index += (ext & 1) * n;
+      victim.tag = (victim.tag & kFingerprintMask) | ((ext >> 1) << bits_per_item);
+    }
+    doublings_++;
+
+    // The stash is usually what filled up; its tags fit now
+    while (this->stash_size_ != 0 && Unstash()) {
+    }
+    return true;
+  }
+
+  using Filter::Size;
+  using Filter::SizeInBytes;
+  using Filter::LoadFactor;
+  using Filter::Valid;
+
+  // number of times Resize may still double the table
+  size_t DoublingsLeft() const { return max_doublings - doublings_; }
+
+  /* methods for providing stats  */
+  // summary infomation
+  std::string Info() const {
+    std::stringstream ss;
+    ss << Filter::Info() << "\t\tDoublings: " << doublings_ << " of "
+       << max_doublings << "\n";
+    return ss.str();
+  }
+
+  // number of bytes Save writes
+  size_t SavedSize() const {
+    return sizeof(ResizableHeader) + Filter::SavedSize();
+  }
+
+  // save the filter to a file
+  bool Save(const std::string path) const {
+    std::ofstream wf(path, std::ios::out | std::ios::binary);
+    if (!wf) {
+      return false;
+    }
+    SaveTo(wf);
+    wf.close();
+    return wf.good();
+  }
+
+  // write the filter to a stream, in the format Save writes to a file; the
+  // caller checks the stream for errors
+  void SaveTo(std::ostream &os) const {
+    ResizableHeader sh;
+    memset(&sh, 0, sizeof(sh));
+    memcpy(sh.magic_, kResizableFormatMagic, sizeof(sh.magic_));
+    sh.version_ = kResizableFormatVersion;
+    sh.bits_per_item_ = bits_per_item;
+    sh.doublings_ = doublings_;
+    sh.max_doublings_ = max_doublings;
+    sh.header_crc_ = Crc32c(0, &sh, offsetof(ResizableHeader, header_crc_));
+    os.write(reinterpret_cast<const char *>(&sh), sizeof(sh));
+    Filter::SaveTo(os);
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_RESIZABLE_CUCKOO_FILTER_H_
@@ -0,0 +1,371 @@
+#ifndef CUCKOO_FILTER_SCALABLE_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_SCALABLE_CUCKOO_FILTER_H_
+
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "cuckoofilter.h"
+
+namespace cuckoofilter {
+
+// start of a saved ScalableCuckooFilter, and the version of its format
+const char kScalableFormatMagic[8] = {'C', 'U', 'C', 'K', 'O', 'O', 'S', 'C'};
+const uint32_t kScalableFormatVersion = 1;
+
+// most generations a ScalableCuckooFilter may have, which bounds its false
+// positive rate to this many times that of one generation
+const size_t kScalableMaxGenerations = 64;
+
+// A cuckoo filter that grows with the number of items instead of being sized
+// for them up front. It is a list of CuckooFilter generations: once the load
+// factor of the newest one crosses load_threshold, a new generation of
+// growth_factor times its capacity is added. Add goes to the newest
+// generation; Contain and Delete look at all of them, newest first.
+//
+// Every generation has the false positive rate e of one CuckooFilter with
+// bits_per_item bit tags, and a key missing from all of them is a false
+// positive if any one matches it. So the rate of the whole filter grows
+// linearly with the number of generations, up to max_generations * e: the
+// tag width is a template parameter, so later generations cannot tighten
+// their own rate the way a scalable Bloom filter does. To stay under a rate
+// r, size the tags for r / max_generations, which takes
+// ceil(log2(max_generations)) bits more than one CuckooFilter for r, 3 for
+// the default 8 generations.
+//
+// growth_factor must be finite and over 1, load_threshold in (0, 1], and
+// max_generations from 1 to kScalableMaxGenerations; the filter is not
+// Valid() otherwise. Add reports NotEnoughSpace once the last generation
+// allowed is full.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class ScalableCuckooFilter : public BaseCuckooFilter<ItemType> {
+  typedef CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> Filter;
+
+  // number of keys ContainBatch looks up in the older generations at once
+  static const size_t kBatchSize = 256;
+  // The header we will use when we save the filter. Each generation follows,
+  // oldest first, as its uint64_t length and what Filter::SaveTo writes,
+  // padded to a multiple of 8 bytes.
+  typedef struct {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t reserved_;
+    uint64_t num_generations_;
+    uint64_t last_capacity_;
+    uint64_t max_generations_;
+    double growth_factor_;
+    double load_threshold_;
+  } SaveHeader;
+
+  // Oldest first
+  std::vector<std::unique_ptr<Filter>> generations_;
+
+  // Number of keys the newest generation was built for
+  size_t last_capacity_;
+
+  double growth_factor_;
+  double load_threshold_;
+  size_t max_generations_;
+  InsertStrategy strategy_;
+
+  // Buffer created if we read the filter from a file
+  char *readbuf_;
+
+  // Does the filter grow by a finite factor over 1, once a generation is
+  // loaded past a threshold in (0, 1], to at most kScalableMaxGenerations
+  // generations
+  static bool ParametersValid(const double growth_factor,
+                              const double load_threshold,
+                              const size_t max_generations) {
+    return growth_factor > 1.0 && std::isfinite(growth_factor) &&
+           load_threshold > 0.0 && load_threshold <= 1.0 &&
+           max_generations >= 1 &&
+           max_generations <= kScalableMaxGenerations;
+  }
+
+  // Add a generation, unless there are max_generations_ already
+  bool Grow() {
+    if (generations_.size() >= max_generations_) {
+      return false;
+    }
+    size_t capacity = last_capacity_;
+    if (!generations_.empty()) {
+      const double grown = capacity * growth_factor_;
+      // past this the capacity does not fit a size_t
+      if (grown >= 1e18) {
+        return false;
+      }
+      capacity = static_cast<size_t>(grown);
+    }
+    std::unique_ptr<Filter> filter(new (std::nothrow) Filter(capacity));
+    if (!filter || !filter->Valid()) {
+      return false;
+    }
+    filter->SetInsertStrategy(strategy_);
+    generations_.push_back(std::move(filter));
+    last_capacity_ = capacity;
+    return true;
+  }
+
+  // Load the generations saved at addr; leaves none if the data is bad
+  void Load(const char *addr, size_t length) {
+    if (length < sizeof(SaveHeader)) {
+      return;
+    }
+    const SaveHeader *sh = reinterpret_cast<const SaveHeader *>(addr);
+    if (memcmp(sh->magic_, kScalableFormatMagic,
+               sizeof(kScalableFormatMagic)) != 0 ||
+        sh->version_ != kScalableFormatVersion ||
+        !ParametersValid(sh->growth_factor_, sh->load_threshold_,
+                         sh->max_generations_) ||
+        sh->num_generations_ == 0 ||
+        sh->num_generations_ > sh->max_generations_ ||
+        sh->last_capacity_ == 0) {
+      return;
+    }
+    last_capacity_ = sh->last_capacity_;
+    max_generations_ = sh->max_generations_;
+    growth_factor_ = sh->growth_factor_;
+    load_threshold_ = sh->load_threshold_;
+
+    size_t offset = sizeof(SaveHeader);
+    for (uint64_t g = 0; g < sh->num_generations_; g++) {
+      uint64_t size;
+      // the padding of the last generation may end past length
+      if (offset > length || length - offset < sizeof(size)) {
+        break;
+      }
+      memcpy(&size, addr + offset, sizeof(size));
+      offset += sizeof(size);
+      if (length - offset < size) {
+        break;
+      }
+      std::unique_ptr<Filter> filter(
+          new (std::nothrow) Filter(const_cast<char *>(addr) + offset, size));
+      if (!filter || !filter->Valid()) {
+        break;
+      }
+      generations_.push_back(std::move(filter));
+      offset += (size + 7) & ~7ULL;
+    }
+    if (generations_.size() != sh->num_generations_) {
+      generations_.clear();
+    }
+  }
+
+ public:
+  // Start with one generation for initial_max_num_keys keys
+  explicit ScalableCuckooFilter(const size_t initial_max_num_keys,
+                                const double growth_factor = 2.0,
+                                const double load_threshold = 0.9,
+                                const size_t max_generations = 8)
+      : last_capacity_(initial_max_num_keys),
+        growth_factor_(growth_factor),
+        load_threshold_(load_threshold),
+        max_generations_(max_generations),
+        strategy_(kRandomWalk),
+        readbuf_(nullptr) {
+    // Caller should call Valid() to ensure filter is built
+    if (ParametersValid(growth_factor, load_threshold, max_generations)) {
+      Grow();
+    }
+  }
+
+  explicit ScalableCuckooFilter(void *addr, size_t length)
+      : last_capacity_(0),
+        growth_factor_(0),
+        load_threshold_(0),
+        max_generations_(0),
+        strategy_(kRandomWalk),
+        readbuf_(nullptr) {
+    // Load the filter from the specified buffer. We will not own the data we
+    // read in, so the caller better not free it...
+    Load(static_cast<char *>(addr), length);
+  }
+
+  explicit ScalableCuckooFilter(const std::string &path)
+      : last_capacity_(0),
+        growth_factor_(0),
+        load_threshold_(0),
+        max_generations_(0),
+        strategy_(kRandomWalk),
+        readbuf_(nullptr) {
+    // Read the saved filter from the specified path. We will own the data we
+    // read in and free it in the destructor.
+    std::ifstream rf(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!rf) {
+      return;
+    }
+    size_t size = rf.tellg();
+    readbuf_ = new char[size];
+    rf.seekg(0);
+    if (!rf.read(readbuf_, size)) {
+      return;
+    }
+    rf.close();
+    Load(readbuf_, size);
+  }
+
+  ~ScalableCuckooFilter() {
+    // The generations may point into readbuf_
+    generations_.clear();
+    delete[] readbuf_;
+  }
+
+  // Add an item to the newest generation, first adding a generation if it
+  // is loaded past the threshold or full.
+  Status Add(const ItemType &item) {
+    if (generations_.back()->LoadFactor() >= load_threshold_) {
+      Grow();
+    }
+    Status status = generations_.back()->Add(item);
+    if (status == NotEnoughSpace && Grow()) {
+      status = generations_.back()->Add(item);
+    }
+    return status;
+  }
+
+  // Report if the item is inserted, with false positive rate.
+  Status Contain(const ItemType &item) const {
+    for (size_t g = generations_.size(); g-- > 0;) {
+      if (generations_[g]->Contain(item) == Ok) {
+        return Ok;
+      }
+    }
+    return NotFound;
+  }
+
+  // Report for each of the n keys if it is inserted. Every generation is
+  // probed with ContainBatch, each older one for only the keys the newer
+  // ones missed.
+  void ContainBatch(const ItemType *keys, size_t n, uint8_t *results) const {
+    generations_.back()->ContainBatch(keys, n, results);
+
+    ItemType pending[kBatchSize];
+    size_t position[kBatchSize];
+    uint8_t found[kBatchSize];
+    for (size_t base = 0; base < n; base += kBatchSize) {
+      const size_t count = std::min(kBatchSize, n - base);
+      for (size_t g = generations_.size() - 1; g-- > 0;) {
+        size_t num_pending = 0;
+        for (size_t k = base; k < base + count; k++) {
+          if (results[k] != Ok) {
+            pending[num_pending] = keys[k];
+            position[num_pending++] = k;
+          }
+        }
+        if (num_pending == 0) {
+          break;
+        }
+        generations_[g]->ContainBatch(pending, num_pending, found);
+        for (size_t k = 0; k < num_pending; k++) {
+          results[position[k]] = found[k];
+        }
+      }
+    }
+  }
+
+  // Delete an key from the filter, from the newest generation that has it.
+  // If the key is a false positive of a newer generation than the one it was
+  // added to, this deletes the key that collides with it there instead.
+  Status Delete(const ItemType &item) {
+    for (size_t g = generations_.size(); g-- > 0;) {
+      if (generations_[g]->Delete(item) == Ok) {
+        return Ok;
+      }
+    }
+    return NotFound;
+  }
+
+  /* methods for providing stats  */
+  // summary infomation
+  std::string Info() const {
+    std::stringstream ss;
+    ss << "ScalableCuckooFilter Status:\n"
+       << "\t\tGenerations: " << generations_.size() << " of at most "
+       << max_generations_ << "\n"
+       << "\t\tGrowth factor: " << growth_factor_ << "\n"
+       << "\t\tLoad threshold: " << load_threshold_ << "\n"
+       << "\t\tKeys stored: " << Size() << "\n"
+       << "\t\tSize: " << SizeInBytes() << " bytes\n";
+    for (size_t g = 0; g < generations_.size(); g++) {
+      ss << "Generation " << g << ":\n" << generations_[g]->Info();
+    }
+    return ss.str();
+  }
+
+  // number of current inserted items;
+  size_t Size() const {
+    size_t size = 0;
+    for (const std::unique_ptr<Filter> &filter : generations_) {
+      size += filter->Size();
+    }
+    return size;
+  }
+
+  // size of the filter in bytes.
+  size_t SizeInBytes() const {
+    size_t size = 0;
+    for (const std::unique_ptr<Filter> &filter : generations_) {
+      size += filter->SizeInBytes();
+    }
+    return size;
+  }
+
+  // number of generations
+  size_t NumGenerations() const { return generations_.size(); }
+
+  // save the filter, all of its generations, to a file
+  bool Save(const std::string path) const {
+    std::ofstream wf(path, std::ios::out | std::ios::binary);
+    if (!wf) {
+      return false;
+    }
+    SaveTo(wf);
+    wf.close();
+    return wf.good();
+  }
+
+  // write the filter to a stream, in the format Save writes to a file; the
+  // caller checks the stream for errors
+  void SaveTo(std::ostream &os) const {
+    SaveHeader sh;
+    memset(&sh, 0, sizeof(sh));
+    memcpy(sh.magic_, kScalableFormatMagic, sizeof(sh.magic_));
+    sh.version_ = kScalableFormatVersion;
+    sh.num_generations_ = generations_.size();
+    sh.last_capacity_ = last_capacity_;
+    sh.max_generations_ = max_generations_;
+    sh.growth_factor_ = growth_factor_;
+    sh.load_threshold_ = load_threshold_;
+    os.write(reinterpret_cast<const char *>(&sh), sizeof(sh));
+
+    const char padding[8] = {0};
+    for (const std::unique_ptr<Filter> &filter : generations_) {
+      uint64_t size = filter->SavedSize();
+      os.write(reinterpret_cast<const char *>(&size), sizeof(size));
+      filter->SaveTo(os);
+      os.write(padding, -size & 7);
+    }
+  }
+
+  bool Valid() const {
+    // Valid means we have at least one generation loaded
+    return !generations_.empty();
+  }
+
+  // Set the insert strategy of every generation, current and future
+  void SetInsertStrategy(const InsertStrategy strategy) {
+    strategy_ = strategy;
+    for (const std::unique_ptr<Filter> &filter : generations_) {
+      filter->SetInsertStrategy(strategy);
+    }
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_SCALABLE_CUCKOO_FILTER_H_
@@ -0,0 +1,304 @@
+#ifndef CUCKOO_FILTER_SHARDED_CUCKOO_FILTER_H_
+#define CUCKOO_FILTER_SHARDED_CUCKOO_FILTER_H_
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "cuckoofilter.h"
+#include "mappedcuckoofilter.h"
+
+namespace cuckoofilter {
+
+// The manifest ShardedCuckooFilter::Save writes at the path it is given; each
+// shard is saved next to it, at ShardPath(path, s), as a plain CuckooFilter.
+// router_data_ is what the router hash saves. Fixed width, little endian.
+const char kShardedMagic[8] = {'C', 'U', 'C', 'K', 'O', 'O', 'S', 'H'};
+const uint32_t kShardedVersion = 1;
+
+struct ShardedHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t num_shards_;
+  unsigned char router_data_[64];
+  uint32_t flags_;
+  uint32_t header_crc_;
+};
+
+// A cuckoo filter split into independent shards, each a CuckooFilter with a
+// lock of its own, so that threads updating different shards do not
+// contend on a lock or an item counter, and a shard can be saved, loaded or
+// mapped on its own. Keys go to a shard by the high bits of a router hash
+// that is independent of the hash the shards use, so shards fill evenly.
+//
+// Every operation locks the shard of its key, and only that one; Size,
+// SizeInBytes, Info and Save go through the shards one at a time. Each
+// shard has the false positive rate of one CuckooFilter, and so has the
+// whole filter.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = TwoIndependentMultiplyShift>
+class ShardedCuckooFilter : public BaseCuckooFilter<ItemType> {
+  typedef CuckooFilter<ItemType, bits_per_item, TableType, HashFamily> Filter;
+  typedef MappedCuckooFilter<ItemType, bits_per_item, TableType, HashFamily>
+      MappedFilter;
+
+  // number of keys ContainBatch routes before probing their shards
+  static const size_t kBatchSize = 256;
+
+  // xor-ed into the seed of a seeded filter to derive the router's
+  static const uint64_t kRouterSalt = 0x5ba7ded5ba7ded5bULL;
+
+  // A shard is allocated on its own and padded past a cache line, so that
+  // the locks of two shards never share one
+  struct Shard {
+    std::mutex mutex;
+    std::unique_ptr<Filter> filter;
+    char padding[64];
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  HashFamily router_;
+
+  inline size_t ShardIndex(const ItemType &item) const {
+    return ((router_(item) >> 32) * shards_.size()) >> 32;
+  }
+
+  // Load the manifest at path and, with load(s, shard_path), every shard;
+  // leaves no shards if one cannot be loaded
+  template <typename LoadShard>
+  void Load(const std::string &path, const LoadShard &load) {
+    ShardedHeader sh;
+    std::ifstream rf(path, std::ios::in | std::ios::binary);
+    if (!rf || !rf.read((char *)&sh, sizeof(sh)) ||
+        memcmp(sh.magic_, kShardedMagic, sizeof(kShardedMagic)) != 0 ||
+        sh.version_ != kShardedVersion ||
+        sh.header_crc_ != Crc32c(0, &sh, offsetof(ShardedHeader, header_crc_)) ||
+        sh.num_shards_ == 0 ||
+        !router_.load(sh.router_data_, sizeof(sh.router_data_))) {
+      return;
+    }
+    for (size_t s = 0; s < sh.num_shards_; s++) {
+      shards_.emplace_back(new Shard);
+      shards_[s]->filter.reset(load(ShardPath(path, s)));
+      if (!shards_[s]->filter || !shards_[s]->filter->Valid()) {
+        shards_.clear();
+        return;
+      }
+    }
+  }
+
+ public:
+  // Split a filter for max_num_keys keys into num_shards shards
+  ShardedCuckooFilter(const size_t max_num_keys, const size_t num_shards)
+      : router_() {
+    for (size_t s = 0; s < num_shards; s++) {
+      shards_.emplace_back(new Shard);
+      shards_[s]->filter.reset(
+          new Filter((max_num_keys + num_shards - 1) / num_shards));
+    }
+  }
+
+  // The same, with the shards and the router derived from seed; HashFamily
+  // must be constructible from a uint64_t
+  ShardedCuckooFilter(const size_t max_num_keys, const size_t num_shards,
+                      const uint64_t seed)
+      : router_(seed ^ kRouterSalt) {
+    for (size_t s = 0; s < num_shards; s++) {
+      shards_.emplace_back(new Shard);
+      shards_[s]->filter.reset(
+          new Filter((max_num_keys + num_shards - 1) / num_shards, seed));
+    }
+  }
+
+  // Load the filter Save wrote to path, reading each shard into memory.
+  // Caller should call Valid().
+  explicit ShardedCuckooFilter(const std::string &path) : router_() {
+    Load(path, [](const std::string &shard_path) {
+      return new Filter(shard_path);
+    });
+  }
+
+  // Load the filter Save wrote to path, mapping each shard as a
+  // MappedCuckooFilter with options. Caller should call Valid().
+  ShardedCuckooFilter(const std::string &path, const MapOptions &options)
+      : router_() {
+    Load(path, [&options](const std::string &shard_path) {
+      return new MappedFilter(shard_path, options);
+    });
+  }
+
+  // where Save puts shard s of the filter saved at path
+  static std::string ShardPath(const std::string &path, const size_t s) {
+    return path + "." + std::to_string(s);
+  }
+
+  // Add an item to its shard.
+  Status Add(const ItemType &item) {
+    Shard &shard = *shards_[ShardIndex(item)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.filter->Add(item);
+  }
+
+  // Report if the item is inserted, with false positive rate.
+  Status Contain(const ItemType &item) const {
+    Shard &shard = *shards_[ShardIndex(item)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.filter->Contain(item);
+  }
+
+  // Report for each of the n keys if it is inserted. The keys are grouped
+  // by shard, a batch at a time, and each group probed with ContainBatch
+  // under one lock of its shard.
+  void ContainBatch(const ItemType *keys, size_t n, uint8_t *results) const {
+    const size_t num_shards = shards_.size();
+    std::vector<size_t> shard_of(kBatchSize), begin(num_shards + 1);
+    std::vector<size_t> position(kBatchSize);
+    std::vector<ItemType> grouped(kBatchSize);
+    std::vector<uint8_t> status(kBatchSize);
+    for (size_t base = 0; base < n; base += kBatchSize) {
+      const size_t count = std::min(kBatchSize, n - base);
+      std::fill(begin.begin(), begin.end(), 0);
+      for (size_t k = 0; k < count; k++) {
+        shard_of[k] = ShardIndex(keys[base + k]);
+        begin[shard_of[k] + 1]++;
+      }
+      for (size_t s = 0; s < num_shards; s++) {
+        begin[s + 1] += begin[s];
+      }
+      std::vector<size_t> next(begin.begin(), begin.end() - 1);
+      for (size_t k = 0; k < count; k++) {
+        const size_t g = next[shard_of[k]]++;
+        grouped[g] = keys[base + k];
+        position[g] = base + k;
+      }
+      for (size_t s = 0; s < num_shards; s++) {
+        if (begin[s] == begin[s + 1]) {
+          continue;
+        }
+        Shard &shard = *shards_[s];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.filter->ContainBatch(&grouped[begin[s]], begin[s + 1] - begin[s],
+                                   &status[begin[s]]);
+      }
+      for (size_t g = 0; g < count; g++) {
+        results[position[g]] = status[g];
+      }
+    }
+  }
+
+  // Delete an key from its shard
+  Status Delete(const ItemType &item) {
+    Shard &shard = *shards_[ShardIndex(item)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.filter->Delete(item);
+  }
+
+  /* methods for providing stats  */
+  // summary infomation, with how unevenly the items are spread: the largest
+  // shard's item count over the mean
+  std::string Info() const {
+    std::vector<size_t> sizes(shards_.size());
+    size_t total = 0, largest = 0;
+    for (size_t s = 0; s < shards_.size(); s++) {
+      std::lock_guard<std::mutex> lock(shards_[s]->mutex);
+      sizes[s] = shards_[s]->filter->Size();
+      total += sizes[s];
+      largest = std::max(largest, sizes[s]);
+    }
+    std::stringstream ss;
+    ss << "ShardedCuckooFilter Status:\n"
+       << "\t\tShards: " << shards_.size() << "\n"
+       << "\t\tKeys stored: " << total << "\n"
+       << "\t\tSize: " << SizeInBytes() << " bytes\n"
+       << "\t\tImbalance: "
+       << (total > 0 ? 1.0 * largest * shards_.size() / total : 1.0) << "\n";
+    for (size_t s = 0; s < shards_.size(); s++) {
+      std::lock_guard<std::mutex> lock(shards_[s]->mutex);
+      ss << "Shard " << s << ": " << sizes[s] << " keys, load factor "
+         << shards_[s]->filter->LoadFactor() << "\n";
+    }
+    return ss.str();
+  }
+
+  // number of current inserted items;
+  size_t Size() const {
+    size_t size = 0;
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      size += shard->filter->Size();
+    }
+    return size;
+  }
+
+  // size of the filter in bytes.
+  size_t SizeInBytes() const {
+    size_t size = 0;
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      size += shard->filter->SizeInBytes();
+    }
+    return size;
+  }
+
+  // number of shards
+  size_t NumShards() const { return shards_.size(); }
+
+  // save the manifest to path and each shard to ShardPath(path, s), each
+  // as of a point between two of its updates
+  bool Save(const std::string path) const {
+    for (size_t s = 0; s < shards_.size(); s++) {
+      if (!SaveShard(s, ShardPath(path, s))) {
+        return false;
+      }
+    }
+    ShardedHeader sh;
+    memset(&sh, 0, sizeof(sh));
+    memcpy(sh.magic_, kShardedMagic, sizeof(sh.magic_));
+    sh.version_ = kShardedVersion;
+    sh.num_shards_ = shards_.size();
+    router_.save(sh.router_data_, sizeof(sh.router_data_));
+    sh.header_crc_ = Crc32c(0, &sh, offsetof(ShardedHeader, header_crc_));
+
+    std::ofstream wf(path, std::ios::out | std::ios::binary);
+    if (!wf) {
+      return false;
+    }
+    wf.write(reinterpret_cast<const char *>(&sh), sizeof(sh));
+    wf.close();
+    return wf.good();
+  }
+
+  // save shard s alone, as a CuckooFilter; after a few updates only the
+  // shards they went to need saving again
+  bool SaveShard(const size_t s, const std::string &path) const {
+    std::lock_guard<std::mutex> lock(shards_[s]->mutex);
+    return shards_[s]->filter->Save(path);
+  }
+
+  bool Valid() const {
+    // Valid means every shard is built
+    if (shards_.empty()) {
+      return false;
+    }
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      if (!shard->filter->Valid()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Set the insert strategy of every shard
+  void SetInsertStrategy(const InsertStrategy strategy) {
+    for (const std::unique_ptr<Shard> &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->filter->SetInsertStrategy(strategy);
+    }
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_SHARDED_CUCKOO_FILTER_H_
@@ -0,0 +1,330 @@
+#ifndef CUCKOO_FILTER_SIMD_UTIL_H_
+#define CUCKOO_FILTER_SIMD_UTIL_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CUCKOO_FILTER_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace cuckoofilter {
+
+// Widest instruction set the bucket probe kernels may use on this cpu
+enum SimdLevel {
+  kSimdScalar = 0,
+  kSimdSSE2 = 1,
+  kSimdAVX2 = 2,
+  kSimdAVX512 = 3,
+};
+
+// The level is read from CPUID once and cached, so kernels can be picked per
+// batch at the cost of one predictable branch.
+inline SimdLevel CpuSimdLevel() {
+#ifdef CUCKOO_FILTER_X86_SIMD
+  static const SimdLevel level =
+      __builtin_cpu_supports("avx512f")
+          ? kSimdAVX512
+          : __builtin_cpu_supports("avx2")
+                ? kSimdAVX2
+                : __builtin_cpu_supports("sse2") ? kSimdSSE2 : kSimdScalar;
+  return level;
+#else
+  return kSimdScalar;
+#endif
+}
+
+// The kernels below probe n keys at once. Each key k has its two candidate
+// buckets at base + off1[k] and base + off2[k]; found[k] is set to 1 if
+// either bucket holds the key's tag and to 0 otherwise.
+//
+// ProbeWords* handle tags of up to 16 bits, where a whole bucket fits in the
+// uint64 read from the start of the bucket. They evaluate the HasValue test
+// from bitsutil.h on several buckets per instruction: pattern[k] is the tag
+// of key k replicated into every slot (ones * tag), ones has the low bit of
+// every slot set and highs the high bit. Reads are unaligned, little endian,
+// and may run past the bucket into the table padding, like the scalar probe.
+//
+// ProbeBuckets32* handle 32 bit tags, where a bucket is four whole uint32s
+// that are compared against the broadcast tag.
+
+inline uint64_t LoadWord(const char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline bool HasValueWord(uint64_t v, uint64_t pattern, uint64_t ones,
+                         uint64_t highs) {
+  uint64_t x = v ^ pattern;
+  return ((x - ones) & ~x & highs) != 0;
+}
+
+inline void ProbeWordsScalar(const char *base, const size_t *off1,
+                             const size_t *off2, const uint64_t *pattern,
+                             size_t n, uint64_t ones, uint64_t highs,
+                             uint8_t *found) {
+  for (size_t k = 0; k < n; k++) {
+    found[k] = HasValueWord(LoadWord(base + off1[k]), pattern[k], ones, highs) ||
+               HasValueWord(LoadWord(base + off2[k]), pattern[k], ones, highs);
+  }
+}
+
+inline void ProbeBuckets32Scalar(const char *base, const size_t *off1,
+                                 const size_t *off2, const uint32_t *tags,
+                                 size_t n, uint8_t *found) {
+  for (size_t k = 0; k < n; k++) {
+    uint32_t b1[4], b2[4];
+    memcpy(b1, base + off1[k], sizeof(b1));
+    memcpy(b2, base + off2[k], sizeof(b2));
+    bool hit = false;
+    for (size_t j = 0; j < 4; j++) {
+      hit |= (b1[j] == tags[k]) | (b2[j] == tags[k]);
+    }
+    found[k] = hit;
+  }
+}
+
+// AllZero* tell if every byte of [p, p + n) is zero, which lets set
+// operations skip the empty stretches of a table at memory speed.
+inline bool AllZeroScalar(const char *p, size_t n) {
+  uint64_t acc = 0;
+  for (; n >= sizeof(uint64_t); p += sizeof(uint64_t), n -= sizeof(uint64_t)) {
+    acc |= LoadWord(p);
+  }
+  for (; n > 0; p++, n--) {
+    acc |= (uint8_t)*p;
+  }
+  return acc == 0;
+}
+
+#ifdef CUCKOO_FILTER_X86_SIMD
+
+__attribute__((target("sse2"))) inline bool AllZeroSSE2(const char *p,
+                                                        size_t n) {
+  __m128i acc = _mm_setzero_si128();
+  for (; n >= 16; p += 16, n -= 16) {
+    acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)p));
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) ==
+             0xffff &&
+         AllZeroScalar(p, n);
+}
+
+__attribute__((target("avx2"))) inline bool AllZeroAVX2(const char *p,
+                                                        size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  for (; n >= 32; p += 32, n -= 32) {
+    acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)p));
+  }
+  return _mm256_testz_si256(acc, acc) && AllZeroScalar(p, n);
+}
+
+__attribute__((target("sse2"))) inline void ProbeWordsSSE2(
+    const char *base, const size_t *off1, const size_t *off2,
+    const uint64_t *pattern, size_t n, uint64_t ones, uint64_t highs,
+    uint8_t *found) {
+  const __m128i vones = _mm_set1_epi64x(ones);
+  const __m128i vhighs = _mm_set1_epi64x(highs);
+  const __m128i zero = _mm_setzero_si128();
+  size_t k = 0;
+  for (; k + 2 <= n; k += 2) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(pattern + k));
+    __m128i x1 = _mm_xor_si128(
+        _mm_set_epi64x(LoadWord(base + off1[k + 1]), LoadWord(base + off1[k])),
+        p);
+    __m128i x2 = _mm_xor_si128(
+        _mm_set_epi64x(LoadWord(base + off2[k + 1]), LoadWord(base + off2[k])),
+        p);
+    __m128i t1 = _mm_and_si128(_mm_andnot_si128(x1, _mm_sub_epi64(x1, vones)),
+                               vhighs);
+    __m128i t2 = _mm_and_si128(_mm_andnot_si128(x2, _mm_sub_epi64(x2, vones)),
+                               vhighs);
+    // SSE2 has no 64 bit compare: a lane is zero if both its halves are
+    int zero_halves = _mm_movemask_ps(
+        _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_or_si128(t1, t2), zero)));
+    found[k] = (zero_halves & 0x3) != 0x3;
+    found[k + 1] = (zero_halves & 0xc) != 0xc;
+  }
+  ProbeWordsScalar(base, off1 + k, off2 + k, pattern + k, n - k, ones, highs,
+                   found + k);
+}
+
+__attribute__((target("avx2"))) inline void ProbeWordsAVX2(
+    const char *base, const size_t *off1, const size_t *off2,
+    const uint64_t *pattern, size_t n, uint64_t ones, uint64_t highs,
+    uint8_t *found) {
+  const __m256i vones = _mm256_set1_epi64x(ones);
+  const __m256i vhighs = _mm256_set1_epi64x(highs);
+  const __m256i zero = _mm256_setzero_si256();
+  const long long *vbase = (const long long *)base;
+  size_t k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m256i p = _mm256_loadu_si256((const __m256i *)(pattern + k));
+    __m256i x1 = _mm256_xor_si256(
+        _mm256_i64gather_epi64(
+            vbase, _mm256_loadu_si256((const __m256i *)(off1 + k)), 1),
+        p);
+    __m256i x2 = _mm256_xor_si256(
+        _mm256_i64gather_epi64(
+            vbase, _mm256_loadu_si256((const __m256i *)(off2 + k)), 1),
+        p);
+    __m256i t1 = _mm256_and_si256(
+        _mm256_andnot_si256(x1, _mm256_sub_epi64(x1, vones)), vhighs);
+    __m256i t2 = _mm256_and_si256(
+        _mm256_andnot_si256(x2, _mm256_sub_epi64(x2, vones)), vhighs);
+    int zero_lanes = _mm256_movemask_pd(_mm256_castsi256_pd(
+        _mm256_cmpeq_epi64(_mm256_or_si256(t1, t2), zero)));
+    for (size_t j = 0; j < 4; j++) {
+      found[k + j] = !((zero_lanes >> j) & 1);
+    }
+  }
+  ProbeWordsScalar(base, off1 + k, off2 + k, pattern + k, n - k, ones, highs,
+                   found + k);
+}
+
+__attribute__((target("avx512f"))) inline void ProbeWordsAVX512(
+    const char *base, const size_t *off1, const size_t *off2,
+    const uint64_t *pattern, size_t n, uint64_t ones, uint64_t highs,
+    uint8_t *found) {
+  const __m512i vones = _mm512_set1_epi64(ones);
+  const __m512i vhighs = _mm512_set1_epi64(highs);
+  const __m512i zero = _mm512_setzero_si512();
+  size_t k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m512i p = _mm512_loadu_si512((const void *)(pattern + k));
+    __m512i x1 = _mm512_xor_si512(
+        _mm512_mask_i64gather_epi64(
+            zero, 0xff, _mm512_loadu_si512((const void *)(off1 + k)),
+            (const void *)base, 1),
+        p);
+    __m512i x2 = _mm512_xor_si512(
+        _mm512_mask_i64gather_epi64(
+            zero, 0xff, _mm512_loadu_si512((const void *)(off2 + k)),
+            (const void *)base, 1),
+        p);
+    // 0x08 selects ~x & (x - ones) & highs
+    __m512i t1 = _mm512_ternarylogic_epi64(x1, _mm512_sub_epi64(x1, vones),
+                                           vhighs, 0x08);
+    __m512i t2 = _mm512_ternarylogic_epi64(x2, _mm512_sub_epi64(x2, vones),
+                                           vhighs, 0x08);
+    __m512i t = _mm512_or_si512(t1, t2);
+    __mmask8 hits = _mm512_test_epi64_mask(t, t);
+    for (size_t j = 0; j < 8; j++) {
+      found[k + j] = (hits >> j) & 1;
+    }
+  }
+  ProbeWordsAVX2(base, off1 + k, off2 + k, pattern + k, n - k, ones, highs,
+                 found + k);
+}
+
+__attribute__((target("sse2"))) inline void ProbeBuckets32SSE2(
+    const char *base, const size_t *off1, const size_t *off2,
+    const uint32_t *tags, size_t n, uint8_t *found) {
+  for (size_t k = 0; k < n; k++) {
+    __m128i t = _mm_set1_epi32(tags[k]);
+    __m128i eq = _mm_or_si128(
+        _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(base + off1[k])), t),
+        _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(base + off2[k])), t));
+    found[k] = _mm_movemask_epi8(eq) != 0;
+  }
+}
+
+__attribute__((target("avx2"))) inline void ProbeBuckets32AVX2(
+    const char *base, const size_t *off1, const size_t *off2,
+    const uint32_t *tags, size_t n, uint8_t *found) {
+  // Both buckets of a key fill one register
+  for (size_t k = 0; k < n; k++) {
+    __m256i b = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i *)(base + off1[k]))),
+        _mm_loadu_si128((const __m128i *)(base + off2[k])), 1);
+    __m256i eq = _mm256_cmpeq_epi32(b, _mm256_set1_epi32(tags[k]));
+    found[k] = _mm256_movemask_epi8(eq) != 0;
+  }
+}
+
+__attribute__((target("avx512f"))) inline void ProbeBuckets32AVX512(
+    const char *base, const size_t *off1, const size_t *off2,
+    const uint32_t *tags, size_t n, uint8_t *found) {
+  // Two keys, four buckets per register; key k in the low half
+  size_t k = 0;
+  for (; k + 2 <= n; k += 2) {
+    __m512i b = _mm512_inserti32x4(
+        _mm512_setzero_si512(),
+        _mm_loadu_si128((const __m128i *)(base + off1[k])), 0);
+    b = _mm512_inserti32x4(
+        b, _mm_loadu_si128((const __m128i *)(base + off2[k])), 1);
+    b = _mm512_inserti32x4(
+        b, _mm_loadu_si128((const __m128i *)(base + off1[k + 1])), 2);
+    b = _mm512_inserti32x4(
+        b, _mm_loadu_si128((const __m128i *)(base + off2[k + 1])), 3);
+    __m512i t = _mm512_mask_set1_epi32(_mm512_set1_epi32(tags[k]), 0xff00,
+                                       tags[k + 1]);
+    __mmask16 hits = _mm512_cmpeq_epi32_mask(b, t);
+    found[k] = (hits & 0x00ff) != 0;
+    found[k + 1] = (hits & 0xff00) != 0;
+  }
+  ProbeBuckets32AVX2(base, off1 + k, off2 + k, tags + k, n - k, found + k);
+}
+
+#endif  // CUCKOO_FILTER_X86_SIMD
+
+// Run the widest AllZero kernel the cpu supports
+inline bool AllZero(const char *p, size_t n) {
+#ifdef CUCKOO_FILTER_X86_SIMD
+  switch (CpuSimdLevel()) {
+    case kSimdAVX512:
+    case kSimdAVX2:
+      return AllZeroAVX2(p, n);
+    case kSimdSSE2:
+      return AllZeroSSE2(p, n);
+    default:
+      break;
+  }
+#endif
+  return AllZeroScalar(p, n);
+}
+
+// Run the widest ProbeWords kernel the cpu supports
+inline void ProbeWords(const char *base, const size_t *off1,
+                       const size_t *off2, const uint64_t *pattern, size_t n,
+                       uint64_t ones, uint64_t highs, uint8_t *found) {
+#ifdef CUCKOO_FILTER_X86_SIMD
+  switch (CpuSimdLevel()) {
+    case kSimdAVX512:
+      return ProbeWordsAVX512(base, off1, off2, pattern, n, ones, highs, found);
+    case kSimdAVX2:
+      return ProbeWordsAVX2(base, off1, off2, pattern, n, ones, highs, found);
+    case kSimdSSE2:
+      return ProbeWordsSSE2(base, off1, off2, pattern, n, ones, highs, found);
+    default:
+      break;
+  }
+#endif
+  ProbeWordsScalar(base, off1, off2, pattern, n, ones, highs, found);
+}
+
+// Run the widest ProbeBuckets32 kernel the cpu supports
+inline void ProbeBuckets32(const char *base, const size_t *off1,
+                           const size_t *off2, const uint32_t *tags, size_t n,
+                           uint8_t *found) {
+#ifdef CUCKOO_FILTER_X86_SIMD
+  switch (CpuSimdLevel()) {
+    case kSimdAVX512:
+      return ProbeBuckets32AVX512(base, off1, off2, tags, n, found);
+    case kSimdAVX2:
+      return ProbeBuckets32AVX2(base, off1, off2, tags, n, found);
+    case kSimdSSE2:
+      return ProbeBuckets32SSE2(base, off1, off2, tags, n, found);
+    default:
+      break;
+  }
+#endif
+  ProbeBuckets32Scalar(base, off1, off2, tags, n, found);
+}
+
+}  // namespace cuckoofilter
+
+#endif  // CUCKOO_FILTER_SIMD_UTIL_H_
@@ -2,17 +2,36 @@
 #define CUCKOO_FILTER_SINGLE_TABLE_H_
 
 #include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
 #include <sstream>
 #include <string.h> // for memset
 
 #include "bitsutil.h"
+#include "simdutil.h"
 
 namespace cuckoofilter {
 
-// the most naive table implementation: one huge bit array
-template <size_t bits_per_tag>
-class SingleTable {
-  static const size_t kTagsPerBucket = 4;
+// the most naive table implementation: one huge bit array, of buckets of
+// tags_per_bucket tags. Use it as SingleTable for 4 tags per bucket, or as
+// Associativity<2>::SingleTable or Associativity<8>::SingleTable.
+template <size_t bits_per_tag, size_t tags_per_bucket = 4>
+class BasicSingleTable {
+  static_assert(tags_per_bucket == 2 || tags_per_bucket == 4 ||
+                    tags_per_bucket == 8,
+                "buckets hold 2, 4 or 8 tags");
+
+ public:
+  static const size_t kTagsPerBucket = tags_per_bucket;
+  // names the table in saved filters: 1 for 4 tags per bucket, as before
+  // the bucket size was a parameter, and 0x201 and 0x801 for 2 and 8
+  static const uint32_t kFormatId =
+      tags_per_bucket == 4 ? 1 : 0x100 * tags_per_bucket + 1;
+  // a tag written to a slot stays there
+  static const bool kStableSlots = true;
+
+ private:
   static const size_t kBytesPerBucket =
       (bits_per_tag * kTagsPerBucket + 7) >> 3;
   static const uint32_t kTagMask = (1ULL << bits_per_tag) - 1;
@@ -20,6 +39,28 @@ class SingleTable {
   // as we always read a uint64
   static const size_t kPaddingBuckets =
     ((((kBytesPerBucket + 7) / 8) * 8) - 1) / kBytesPerBucket;
+  // bytes a bucket probe touches, starting at the bucket
+  static const size_t kBytesPerProbe =
+      kBytesPerBucket > sizeof(uint64_t) ? kBytesPerBucket : sizeof(uint64_t);
+  // The SWAR masks of the slots of a bucket in the uint64 at its start. If
+  // they cover them all the bucket is probed with one word; buckets of whole
+  // 8, 16 or 32 bit slots longer than a uint64 are probed a word at a time.
+  typedef SlotMasks<bits_per_tag, kTagsPerBucket> Masks;
+  static const size_t kWordsPerBucket =
+      (bits_per_tag == 8 || bits_per_tag == 16 || bits_per_tag == 32) &&
+              kBytesPerBucket % sizeof(uint64_t) == 0
+          ? kBytesPerBucket / sizeof(uint64_t)
+          : 0;
+
+  // Does the bucket at p hold tag, testing one word of whole slots at a time
+  static inline bool FindTagInWords(const char *p, const uint32_t tag) {
+    bool found = false;
+    for (size_t w = 0; w < kWordsPerBucket; w++) {
+      found |= HasValue<bits_per_tag, 64 / bits_per_tag>(
+          LoadWord(p + w * sizeof(uint64_t)), tag);
+    }
+    return found;
+  }
 
   struct Bucket {
     char bits_[kBytesPerBucket];
@@ -31,13 +72,17 @@ class SingleTable {
   bool own_mem_ = true;
 
  public:
-  explicit SingleTable(const size_t num) : num_buckets_(num) {
-    buckets_ = new Bucket[num_buckets_ + kPaddingBuckets];
-    memset(buckets_, 0, kBytesPerBucket * (num_buckets_ + kPaddingBuckets));
+  explicit BasicSingleTable(const size_t num) : num_buckets_(num) {
+    // malloc rather than new[], so that Resize can realloc
+    buckets_ = static_cast<Bucket *>(malloc(SizeInBytes()));
+    if (!buckets_) {
+      throw std::bad_alloc();
+    }
+    memset(buckets_, 0, SizeInBytes());
     own_mem_ = true;
   }
 
-  explicit SingleTable(void *addr, size_t length) {
+  explicit BasicSingleTable(void *addr, size_t length) {
     // We were given the memory area to use. Set the buckets pointer and
     // calculate the number of buckets
     buckets_ = static_cast<Bucket *>(addr);
@@ -45,10 +90,37 @@ class SingleTable {
     own_mem_ = false;
   }
 
-  ~SingleTable() { 
+  ~BasicSingleTable() { 
+    if (own_mem_) {
+      free(buckets_);
+    }
+  }
+
+  // Grow the table to num buckets, keeping the first NumBuckets() of them.
+  // The new buckets are empty. Memory we own is realloc'ed, which large
+  // tables get by remapping pages rather than copying them; memory we were
+  // given is copied into memory we own. Returns false if out of memory.
+  bool Resize(const size_t num) {
+    assert(num >= num_buckets_);
+    const size_t old_bytes = kBytesPerBucket * num_buckets_;
+    const size_t new_bytes = kBytesPerBucket * (num + kPaddingBuckets);
+    Bucket *buckets;
     if (own_mem_) {
-      delete[] buckets_;
+      buckets = static_cast<Bucket *>(realloc(buckets_, new_bytes));
+    } else {
+      buckets = static_cast<Bucket *>(malloc(new_bytes));
+      if (buckets) {
+        memcpy(buckets, buckets_, old_bytes);
+      }
+    }
+    if (!buckets) {
+      return false;
     }
+    memset((char *)buckets + old_bytes, 0, new_bytes - old_bytes);
+    buckets_ = buckets;
+    num_buckets_ = num;
+    own_mem_ = true;
+    return true;
   }
 
   size_t NumBuckets() const {
@@ -68,6 +140,10 @@ class SingleTable {
     return (unsigned char *)buckets_;
   }
 
+  unsigned char * Data() {
+    return (unsigned char *)buckets_;
+  }
+
   std::string Info() const {
     std::stringstream ss;
     ss << "SingleHashtable with tag size: " << bits_per_tag << " bits \n";
@@ -77,29 +153,35 @@ class SingleTable {
     return ss.str();
   }
 
+  // Are buckets [begin, end), begin < end, all empty; an empty bucket is
+  // all zero bits, so they are checked a vector at a time
+  inline bool BucketsEmpty(const size_t begin, const size_t end) const {
+    return AllZero((const char *)(buckets_ + begin),
+                   (end - begin) * kBytesPerBucket);
+  }
+
+  // Start loading bucket i into the cache ahead of a FindTagInBuckets call.
+  // A probe reads at least a uint64 from the start of the bucket, which may
+  // cross into the next cache line, so both ends of that read are prefetched.
+  inline void PrefetchBucket(const size_t i) const {
+    const char *p = buckets_[i].bits_;
+    __builtin_prefetch(p);
+    __builtin_prefetch(p + kBytesPerProbe - 1);
+  }
+
   // read tag from pos(i,j)
   inline uint32_t ReadTag(const size_t i, const size_t j) const {
     const char *p = buckets_[i].bits_;
-    uint32_t tag;
     /* following code only works for little-endian */
-    if (bits_per_tag == 2) {
-      tag = *((uint8_t *)p) >> (j * 2);
-    } else if (bits_per_tag == 4) {
-      p += (j >> 1);
-      tag = *((uint8_t *)p) >> ((j & 1) << 2);
-    } else if (bits_per_tag == 8) {
-      p += j;
-      tag = *((uint8_t *)p);
-    } else if (bits_per_tag == 12) {
-      p += j + (j >> 1);
-      tag = *((uint16_t *)p) >> ((j & 1) << 2);
+    if (bits_per_tag == 8) {
+      return ((uint8_t *)p)[j];
     } else if (bits_per_tag == 16) {
-      p += (j << 1);
-      tag = *((uint16_t *)p);
+      return ((uint16_t *)p)[j];
     } else if (bits_per_tag == 32) {
-      tag = ((uint32_t *)p)[j];
+      return ((uint32_t *)p)[j];
+    } else {
+      return PackedSlots<bits_per_tag, kBytesPerProbe>::Read(p, j);
     }
-    return tag & kTagMask;
   }
 
   // write tag to pos(i,j)
@@ -107,32 +189,14 @@ class SingleTable {
     char *p = buckets_[i].bits_;
     uint32_t tag = t & kTagMask;
     /* following code only works for little-endian */
-    if (bits_per_tag == 2) {
-      *((uint8_t *)p) |= tag << (2 * j);
-    } else if (bits_per_tag == 4) {
-      p += (j >> 1);
-      if ((j & 1) == 0) {
-        *((uint8_t *)p) &= 0xf0;
-        *((uint8_t *)p) |= tag;
-      } else {
-        *((uint8_t *)p) &= 0x0f;
-        *((uint8_t *)p) |= (tag << 4);
-      }
-    } else if (bits_per_tag == 8) {
+    if (bits_per_tag == 8) {
       ((uint8_t *)p)[j] = tag;
-    } else if (bits_per_tag == 12) {
-      p += (j + (j >> 1));
-      if ((j & 1) == 0) {
-        ((uint16_t *)p)[0] &= 0xf000;
-        ((uint16_t *)p)[0] |= tag;
-      } else {
-        ((uint16_t *)p)[0] &= 0x000f;
-        ((uint16_t *)p)[0] |= (tag << 4);
-      }
     } else if (bits_per_tag == 16) {
       ((uint16_t *)p)[j] = tag;
     } else if (bits_per_tag == 32) {
       ((uint32_t *)p)[j] = tag;
+    } else {
+      PackedSlots<bits_per_tag, kBytesPerProbe>::Write(p, j, tag);
     }
   }
 
@@ -141,53 +205,66 @@ class SingleTable {
     const char *p1 = buckets_[i1].bits_;
     const char *p2 = buckets_[i2].bits_;
 
-    uint64_t v1 = *((uint64_t *)p1);
-    uint64_t v2 = *((uint64_t *)p2);
-
     // caution: unaligned access & assuming little endian
-    if (bits_per_tag == 4 && kTagsPerBucket == 4) {
-      return hasvalue4(v1, tag) || hasvalue4(v2, tag);
-    } else if (bits_per_tag == 8 && kTagsPerBucket == 4) {
-      return hasvalue8(v1, tag) || hasvalue8(v2, tag);
-    } else if (bits_per_tag == 12 && kTagsPerBucket == 4) {
-      return hasvalue12(v1, tag) || hasvalue12(v2, tag);
-    } else if (bits_per_tag == 16 && kTagsPerBucket == 4) {
-      return hasvalue16(v1, tag) || hasvalue16(v2, tag);
+    if (Masks::kSlots == kTagsPerBucket) {
+      // the whole bucket is in the uint64 at its start
+      uint64_t v1 = *((uint64_t *)p1);
+      uint64_t v2 = *((uint64_t *)p2);
+      return HasValue<bits_per_tag, kTagsPerBucket>(v1, tag) ||
+             HasValue<bits_per_tag, kTagsPerBucket>(v2, tag);
+    } else if (kWordsPerBucket > 1) {
+      return FindTagInWords(p1, tag) || FindTagInWords(p2, tag);
     } else {
-      for (size_t j = 0; j < kTagsPerBucket; j++) {
-        if ((ReadTag(i1, j) == tag) || (ReadTag(i2, j) == tag)) {
-          return true;
+      return FindTagInBucket(i1, tag) || FindTagInBucket(i2, tag);
+    }
+  }
+
+  // FindTagInBuckets for n keys at once: found[k] is set to whether bucket
+  // i1[k] or i2[k] holds tags[k]. The buckets of several keys are compared
+  // per instruction with the widest vector unit the cpu has (see simdutil.h).
+  inline void FindTagInBucketsBatch(const size_t *i1, const size_t *i2,
+                                    const uint32_t *tags, const size_t n,
+                                    uint8_t *found) const {
+    const size_t kChunk = 16;
+    size_t off1[kChunk], off2[kChunk];
+    uint64_t pattern[kChunk];
+    const char *base = buckets_[0].bits_;
+
+    for (size_t b = 0; b < n; b += kChunk) {
+      const size_t count = std::min(kChunk, n - b);
+      for (size_t k = 0; k < count; k++) {
+        off1[k] = i1[b + k] * kBytesPerBucket;
+        off2[k] = i2[b + k] * kBytesPerBucket;
+      }
+      if (bits_per_tag == 32 && kTagsPerBucket == 4) {
+        ProbeBuckets32(base, off1, off2, tags + b, count, found + b);
+      } else if (Masks::kSlots == kTagsPerBucket) {
+        for (size_t k = 0; k < count; k++) {
+          pattern[k] = Masks::kLow * tags[b + k];
+        }
+        ProbeWords(base, off1, off2, pattern, count, Masks::kLow,
+                   Masks::kHigh, found + b);
+      } else {
+        for (size_t k = 0; k < count; k++) {
+          found[b + k] = FindTagInBuckets(i1[b + k], i2[b + k], tags[b + k]);
         }
       }
-      return false;
     }
   }
 
   inline bool FindTagInBucket(const size_t i, const uint32_t tag) const {
     // caution: unaligned access & assuming little endian
-    if (bits_per_tag == 4 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
-      uint64_t v = *(uint64_t *)p;  // uint16_t may suffice
-      return hasvalue4(v, tag);
-    } else if (bits_per_tag == 8 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
-      uint64_t v = *(uint64_t *)p;  // uint32_t may suffice
-      return hasvalue8(v, tag);
-    } else if (bits_per_tag == 12 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
-      uint64_t v = *(uint64_t *)p;
-      return hasvalue12(v, tag);
-    } else if (bits_per_tag == 16 && kTagsPerBucket == 4) {
-      const char *p = buckets_[i].bits_;
-      uint64_t v = *(uint64_t *)p;
-      return hasvalue16(v, tag);
+    const char *p = buckets_[i].bits_;
+    if (kWordsPerBucket > 1) {
+      return FindTagInWords(p, tag);
     } else {
-      for (size_t j = 0; j < kTagsPerBucket; j++) {
-        if (ReadTag(i, j) == tag) {
-          return true;
-        }
+      // the slots that fit in the uint64 at the start of the bucket at once,
+      // with wide tags or many slots the rest one by one
+      bool found = HasValue<bits_per_tag, kTagsPerBucket>(*(uint64_t *)p, tag);
+      for (size_t j = Masks::kSlots; j < kTagsPerBucket; j++) {
+        found |= (ReadTag(i, j) == tag);
       }
-      return false;
+      return found;
     }
   }
 
@@ -228,5 +305,24 @@ class SingleTable {
     return num;
   }
 };
+
+// The table of 4 tags per bucket
+template <size_t bits_per_tag>
+using SingleTable = BasicSingleTable<bits_per_tag, 4>;
+
+// The tables of tags_per_bucket tags per bucket, to pass as the TableType of
+// a CuckooFilter:
+//
+//   CuckooFilter<uint64_t, 8, Associativity<8>::SingleTable> filter(n);
+//
+// More tags per bucket reach a higher load factor before an insert fails,
+// at the cost of more false positives per bit of tag and more tags to
+// compare per probe.
+template <size_t tags_per_bucket>
+struct Associativity {
+  template <size_t bits_per_tag>
+  using SingleTable = BasicSingleTable<bits_per_tag, tags_per_bucket>;
+};
+
 }  // namespace cuckoofilter
 #endif  // CUCKOO_FILTER_SINGLE_TABLE_H_
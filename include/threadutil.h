@@ -0,0 +1,37 @@
+#ifndef CUCKOO_FILTER_THREAD_UTIL_H_
+#define CUCKOO_FILTER_THREAD_UTIL_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace cuckoofilter {
+
+// Call fn(k) for every k in [0, n) on num_threads threads, the calling thread
+// being one of them, and return once all the calls have. Each thread makes
+// the calls for one contiguous run of k, in order. Code that calls this must
+// be linked with -pthread.
+template <typename Fn>
+void ParallelFor(const size_t n, size_t num_threads, const Fn &fn) {
+  num_threads = std::max<size_t>(1, std::min(num_threads, n));
+  auto run = [&fn, n, num_threads](size_t t) {
+    const size_t end = n * (t + 1) / num_threads;
+    for (size_t k = n * t / num_threads; k < end; k++) {
+      fn(k);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < num_threads; t++) {
+    threads.emplace_back(run, t);
+  }
+  run(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_THREAD_UTIL_H_
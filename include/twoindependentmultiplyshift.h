@@ -11,6 +11,9 @@ class TwoIndependentMultiplyShift {
   unsigned __int128 multiply_, add_;
 
  public:
+  // names the hash family in saved filters
+  static const uint32_t kFormatId = 1;
+
   TwoIndependentMultiplyShift() {
     ::std::random_device random;
     for (auto v : {&multiply_, &add_}) {
@@ -22,7 +25,22 @@ class TwoIndependentMultiplyShift {
     }
   }
 
-  TwoIndependentMultiplyShift(TwoIndependentMultiplyShift &src) {
+  // Derive the hash function from seed, so that filters built with the same
+  // seed hash alike and can be compared or merged
+  explicit TwoIndependentMultiplyShift(uint64_t seed) {
+    for (auto v : {&multiply_, &add_}) {
+      *v = 0;
+      for (int i = 0; i < 2; ++i) {
+        // SplitMix64
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        *v = (*v << 64) | (z ^ (z >> 31));
+      }
+    }
+  }
+
+  TwoIndependentMultiplyShift(const TwoIndependentMultiplyShift &src) {
     multiply_ = src.multiply_;
     add_ = src.add_;
   }
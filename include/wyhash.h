@@ -0,0 +1,149 @@
+#ifndef CUCKOO_FILTER_WYHASH_H_
+#define CUCKOO_FILTER_WYHASH_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace cuckoofilter {
+
+// A HashFamily for keys that are byte strings: std::string, std::string_view
+// (C++17) or any span given as a pointer and a length. It is Wang Yi's
+// wyhash (final version 4), which hashes a string in a single pass at well
+// over 10 GB/s, so keys such as URLs need not be hashed to integers first:
+//
+//   CuckooFilter<std::string, 12, SingleTable, WyHash> filter(total_items);
+//   filter.Add(url);
+//
+// Integer keys are hashed as their 8 little-endian bytes. The seed is random
+// unless given, and saved and loaded with the filter.
+class WyHash {
+  uint64_t seed_;
+
+  static const uint64_t kSecret0 = 0x2d358dccaa6c78a5ULL;
+  static const uint64_t kSecret1 = 0x8bb84b93962eacc9ULL;
+  static const uint64_t kSecret2 = 0x4b33a62ed433d4a3ULL;
+  static const uint64_t kSecret3 = 0x4d5a2da51de1aa47ULL;
+
+  // 128 bit product of a and b, the low half in a and the high half in b
+  static inline void Multiply(uint64_t *a, uint64_t *b) {
+    unsigned __int128 r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+  }
+
+  static inline uint64_t Mix(uint64_t a, uint64_t b) {
+    Multiply(&a, &b);
+    return a ^ b;
+  }
+
+  /* following code only works for little-endian */
+  static inline uint64_t Read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static inline uint64_t Read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  // 1 to 3 bytes
+  static inline uint64_t Read3(const uint8_t *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+  }
+
+ public:
+  // names the hash family in saved filters
+  static const uint32_t kFormatId = 2;
+
+  WyHash() {
+    ::std::random_device random;
+    seed_ = (uint64_t)random() << 32 | random();
+  }
+
+  explicit WyHash(const uint64_t seed) : seed_(seed) {}
+
+  // hash of the len bytes at data
+  uint64_t operator()(const void *data, size_t len) const {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint64_t seed = seed_ ^ Mix(seed_ ^ kSecret0, kSecret1);
+    uint64_t a, b;
+    if (__builtin_expect(len <= 16, 1)) {
+      if (__builtin_expect(len >= 4, 1)) {
+        a = (Read4(p) << 32) | Read4(p + ((len >> 3) << 2));
+        b = (Read4(p + len - 4) << 32) | Read4(p + len - 4 - ((len >> 3) << 2));
+      } else if (__builtin_expect(len > 0, 1)) {
+        a = Read3(p, len);
+        b = 0;
+      } else {
+        a = b = 0;
+      }
+    } else {
+      size_t i = len;
+      if (__builtin_expect(i > 48, 0)) {
+        uint64_t see1 = seed, see2 = seed;
+        do {
+          seed = Mix(Read8(p) ^ kSecret1, Read8(p + 8) ^ seed);
+          see1 = Mix(Read8(p + 16) ^ kSecret2, Read8(p + 24) ^ see1);
+          see2 = Mix(Read8(p + 32) ^ kSecret3, Read8(p + 40) ^ see2);
+          p += 48;
+          i -= 48;
+        } while (__builtin_expect(i > 48, 1));
+        seed ^= see1 ^ see2;
+      }
+      while (__builtin_expect(i > 16, 0)) {
+        seed = Mix(Read8(p) ^ kSecret1, Read8(p + 8) ^ seed);
+        i -= 16;
+        p += 16;
+      }
+      a = Read8(p + i - 16);
+      b = Read8(p + i - 8);
+    }
+    a ^= kSecret1;
+    b ^= seed;
+    Multiply(&a, &b);
+    return Mix(a ^ kSecret0 ^ len, b ^ kSecret1);
+  }
+
+  uint64_t operator()(const std::string &key) const {
+    return (*this)(key.data(), key.size());
+  }
+
+#if __cplusplus >= 201703L
+  uint64_t operator()(std::string_view key) const {
+    return (*this)(key.data(), key.size());
+  }
+#endif
+
+  uint64_t operator()(uint64_t key) const {
+    return (*this)(&key, sizeof(key));
+  }
+
+  bool save(unsigned char *buf, size_t len) const {
+    if (len < sizeof(seed_)) {
+      return false;
+    }
+    memcpy(buf, &seed_, sizeof(seed_));
+    return true;
+  }
+
+  bool load(unsigned char *buf, size_t len) {
+    if (len < sizeof(seed_)) {
+      return false;
+    }
+    memcpy(&seed_, buf, sizeof(seed_));
+    return true;
+  }
+};
+
+}  // namespace cuckoofilter
+#endif  // CUCKOO_FILTER_WYHASH_H_